@@ -30,23 +30,34 @@
  * @def UPLINK_OVERHEAD_BYTES
  * @brief Anzahl Bytes, die für Header und Metadaten im Uplink reserviert sind
  *
- * Enthält:
- * - 1 Byte Header (z. B. 0xA2)
+ * Enthält (Datenrahmen UPLINK_HEADER_LOG_BLOCK, siehe modules/uplink.h):
+ * - 1 Byte Header
  * - 1 Byte Sequenznummer
- * - 4 Byte Geräte-ID
+ * - 2 Byte Geräte-ID
+ * - 4 Byte Nummer des ersten Datensatzes der Seite
+ * - 1 Byte Offset in der Seite
  * - 1 Byte Payload-Länge
  * - 1 Byte CRC-8
  */
-#define UPLINK_OVERHEAD_BYTES 7
+#define UPLINK_OVERHEAD_BYTES 11
+
+/**
+ * @def UPLINK_FRAME_DATA_BYTES
+ * @brief Nutzdaten eines Datenrahmens in Byte (Ausschnitt einer Log-Seite)
+ *
+ * Der Rahmen samt Längenbyte muss in den RFM69-FIFO (66 Byte) passen, also
+ * höchstens 54 Byte. Mit 52 Byte geht eine volle Seite (256 Byte) in 5 Rahmen,
+ * 2 Byte bleiben als Reserve.
+ */
+#define UPLINK_FRAME_DATA_BYTES 52
 
 /**
  * @def MAX_UPLINK_PACKET_SIZE
  * @brief Maximale Paketgröße für einen Funk-Uplink
  *
- * Berechnet aus Overhead + Nutzdaten (5 Byte pro Messwert).
- * MAX_RECORDS_PER_PACKET wird an anderer Stelle definiert (z. B. radio.h).
+ * Berechnet aus Overhead + Nutzdaten eines Datenrahmens.
  */
-#define MAX_UPLINK_PACKET_SIZE (UPLINK_OVERHEAD_BYTES + MAX_RECORDS_PER_PACKET * 5)
+#define MAX_UPLINK_PACKET_SIZE (UPLINK_OVERHEAD_BYTES + UPLINK_FRAME_DATA_BYTES)
 
 /**
  * @def MAX_RADIO_ATTEMPTS
@@ -62,4 +73,26 @@
  */
 #define MAX_RESEND_DELAY_MS 1000
 
+/**
+ * @def PING_ACK_INLINE_RTC
+ * @brief 1 = Gateway-Quittung des Pings trägt die Uhrzeit (CMD_ACK_SET_RTC)
+ *
+ * Ersetzt das Protokoll Ping → ACK → CMD_SET_RTC_OFFSET → 3 × ACK_BY_SENSOR
+ * durch Ping (UPLINK_HEADER_PING) → CMD_ACK_SET_RTC. Der Sensor bestätigt
+ * implizit mit dem ersten Datenrahmen bzw. dem nächsten Ping. 0 = bisheriges
+ * Protokoll über packet_handler.
+ */
+#define PING_ACK_INLINE_RTC 1
+
+/**
+ * @def FLASH_WRITE_CHUNK_BYTES
+ * @brief Blockgröße (Byte), ab der gepufferte Datensätze ins externe Flash programmiert werden
+ *
+ * Datensätze werden im RAM-Abbild der aktuellen Flash-Seite gesammelt und erst
+ * blockweise programmiert. Größere Werte sparen Flash-Zugriffe und Energie,
+ * erhöhen aber die Anzahl Datensätze, die bei Reset/Brownout verloren gehen
+ * können (werden beim Neustart erkannt und markiert). Maximal eine Seite (256).
+ */
+#define FLASH_WRITE_CHUNK_BYTES 64
+
 #endif // CONFIG_H
@@ -18,6 +18,7 @@ typedef uint8_t rtc_alarm_t;
 //void rtc_init(void);
 //void rtc_get_time(uint8_t* hour, uint8_t* minute, uint8_t* second);
 timestamp_t rtc_get_timestamp(void);
+void rtc_set_date_time(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second);
 //void rtc_set_unix_timestamp(uint32_t unix_time);
 
 // ───────────── Alarmfunktionen ─────────────
@@ -22,6 +22,7 @@
 // #define DEBUG_STORAGE_C 1
 #define DEBUG_MAIN_C 1
 #define DEBUG_STATE_MACHINE_C 1
+// #define DEBUG_RESET_SETTINGS_AT_BOOT 1 // Standardwerte bei jedem Start (löscht auch den Flash!)
 
 ////////// General Configuration for All Configurations (i.e., debug & release)
 #define DEVICE_ID_LSB 0x00
@@ -58,6 +59,7 @@
 #define DEFAULT_MEAS_INTERVAL_5MIN 1 /////////////// 1 = every 5min
 #define DEFAULT_MEAS_FIXED_HOUR 10
 #define DEFAULT_MEAS_FIXED_MINUTE 0
+#define RADIO_SLOT_SEC 10 ////////////////////////// Länge eines Sendeslots innerhalb des Sendeintervalls (Versatz nach Geräte-ID)
 
 //// MODE_WAIT_FOR_ACTIVATION
 #define MAX_ACTIVATION_PING_SEND_RETRIES 3
@@ -67,12 +69,20 @@
 #define WAIT_FOR_ACT_CMD_TIMEOUT_LOOP 100
 
 //// MODE_DATA_TRANSFER
+#define DEFAULT_TRANSFER_MODE 1                // 0 = alle gespeicherten Datensätze, 1 = nur neue (ab transfer_acked_upto)
 #define MAX_DT_XFER_PING_SEND_RETRIES 5
 #define DT_XFER_PING_DELAY_BEFORE_RETRY 100
-#define DT_XFER_ACK_TIMEOUT 1000
+#define DT_XFER_ACK_TIMEOUT 1000               // Obergrenze; ohne Messung gilt dieser Wert, sonst uplink_ack_timeout_ms()
+#define DT_XFER_ACK_TIMEOUT_MIN 40             // Untergrenze des gemessenen ACK-Timeouts
+#define DT_XFER_BACKOFF_BASE_MS 50             // Wartezeit nach dem ersten Verlust, verdoppelt je weiterem (bis MAX_RESEND_DELAY_MS)
 #define DT_XFER_CMD_TIMEOUT 200
 #define TIMEOUT_DT_XFER_WAIT_FOR_CMD 100
-#define DT_XFER_MAX_DT_PACKET_SEND_RETRIES 5
+#define DT_XFER_MAX_DT_PACKET_SEND_RETRIES 5   // Sendedurchgänge eines Fensters ohne Fortschritt
+#define DT_XFER_WINDOW_FRAMES 12               // Datenrahmen je Fenster (max. 16, Bitmap in CMD_WINDOW_ACK)
+#define DT_XFER_SESSION_BUDGET_MS 20000UL     // Funkzeit je Sitzung (Datenphase), danach Fortsetzung in der nächsten
+#define DT_XFER_TX_POWER_ADAPT 1               // 1 = Sendeleistung nach RSSI der Quittungen absenken
+#define DT_XFER_RSSI_TARGET_DBM (-85)          // Ziel-RSSI der Quittungen; darunter wird die Leistung wieder erhöht
+#define DT_XFER_TX_POWER_MAX_REDUCTION 12      // maximale Absenkung in dB (Schritte der OutputPower)
 
 #endif
 
@@ -97,6 +107,7 @@
 #define DEFAULT_MEAS_INTERVAL_5MIN 2                 /// 2 = 10min intervals
 #define DEFAULT_MEAS_FIXED_HOUR 10                   /// not relevant, only for fixed-time alert
 #define DEFAULT_MEAS_FIXED_MINUTE 0                  /// not relevant, only for fixed-time alert
+#define RADIO_SLOT_SEC 15                            /// 15s slots: 120 slots per 30min send interval
 
 //// MODE_WAIT_FOR_ACTIVATION
 #define MAX_ACTIVATION_PING_SEND_RETRIES 3
@@ -106,12 +117,20 @@
 #define WAIT_FOR_ACT_CMD_TIMEOUT_LOOP 100
 
 //// MODE_DATA_TRANSFER
+#define DEFAULT_TRANSFER_MODE 1                // 0 = alle gespeicherten Datensätze, 1 = nur neue (ab transfer_acked_upto)
 #define MAX_DT_XFER_PING_SEND_RETRIES 5
 #define DT_XFER_PING_DELAY_BEFORE_RETRY 100
-#define DT_XFER_ACK_TIMEOUT 1000
+#define DT_XFER_ACK_TIMEOUT 1000               // Obergrenze; ohne Messung gilt dieser Wert, sonst uplink_ack_timeout_ms()
+#define DT_XFER_ACK_TIMEOUT_MIN 40             // Untergrenze des gemessenen ACK-Timeouts
+#define DT_XFER_BACKOFF_BASE_MS 50             // Wartezeit nach dem ersten Verlust, verdoppelt je weiterem (bis MAX_RESEND_DELAY_MS)
 #define DT_XFER_CMD_TIMEOUT 200
 #define TIMEOUT_DT_XFER_WAIT_FOR_CMD 100
-#define DT_XFER_MAX_DT_PACKET_SEND_RETRIES 5
+#define DT_XFER_MAX_DT_PACKET_SEND_RETRIES 5   // Sendedurchgänge eines Fensters ohne Fortschritt
+#define DT_XFER_WINDOW_FRAMES 12               // Datenrahmen je Fenster (max. 16, Bitmap in CMD_WINDOW_ACK)
+#define DT_XFER_SESSION_BUDGET_MS 60000UL     // Funkzeit je Sitzung (Datenphase), danach Fortsetzung in der nächsten
+#define DT_XFER_TX_POWER_ADAPT 1               // 1 = Sendeleistung nach RSSI der Quittungen absenken
+#define DT_XFER_RSSI_TARGET_DBM (-85)          // Ziel-RSSI der Quittungen; darunter wird die Leistung wieder erhöht
+#define DT_XFER_TX_POWER_MAX_REDUCTION 12      // maximale Absenkung in dB (Schritte der OutputPower)
 #endif
 
 // === Downlink-Befehle (DFP-3) ===
@@ -125,21 +144,34 @@
 #define CMD_SET_ACTIVATION_MODE 0x07      // (derzeit nicht zur Laufzeit erlaubt)
 #define CMD_SOFT_RESET 0x08               // Gerätesoftware neu starten
 #define CMD_ACTIVATION 0x09               // Geräteaktivierung (z. B. nach Erstinstallation)
+#define CMD_WINDOW_ACK 0x0A               // Sammelquittung eines Fensters von Datenrahmen (Bitmap)
+#define CMD_ACK_SET_RTC 0x0B              // Quittung auf UPLINK_HEADER_PING mit Uhrzeit (PING_ACK_INLINE_RTC)
+
+// === Uplink-Rahmen der Datenübertragung (modules/uplink.c) ===
+
+#define UPLINK_HEADER_LOG_BLOCK 0xB1      // Ausschnitt einer Log-Seite, kodiert wie im Flash
+#define UPLINK_HEADER_LOG_BLOCK_LAST 0xB2 // wie oben, letzter Rahmen eines Sendedurchgangs: Gateway antwortet mit CMD_WINDOW_ACK
+#define UPLINK_HEADER_PING 0xB3           // Ping für Aktivierung/Datenübertragung: Gateway antwortet mit CMD_ACK_SET_RTC
 
 // === Flags ===
 #define SETTINGS_FLAG_FLASH_ERASE_DONE (1 << 0)
+#define SETTINGS_FLAG_TRANSFER_RESUME (1 << 1) // letzte Übertragung unvollständig: nächste Sitzung setzt bei transfer_acked_upto fort
 
 // === Struktur der Gerätekonfiguration ===
 
+/// Version des Layouts von settings_t; den festen Platz davor (Version 1, ohne Versionsbyte) migriert settings_load()
+#define SETTINGS_VERSION 2
+
 /**
  * @brief Persistente Geräteeinstellungen, gespeichert im EEPROM
  */
 typedef struct
 {
+    uint8_t version;                             ///< Layout-Version (SETTINGS_VERSION)
     uint8_t high_temp_measurement_interval_5min; ///< Intervall im HIGH_TEMPERATURE-Modus
     uint8_t transfer_mode;                       ///< 0 = alle Daten, 1 = nur neue Datensätze
     uint8_t flags;                               ///< z. B. Bit 0 = Flash initialized
-    uint8_t flash_record_count;                  ///< Anzahl Datensätze im externen Flash
+    uint32_t transfer_acked_upto;                ///< Datensätze vor diesem Index hat das Gateway bestätigt (fester Platz: flash_record_count, ungenutzt)
     uint8_t send_mode;                           ///< 0 = periodisch, 1 = feste Uhrzeit
     uint8_t send_interval_5min;                  ///< nur bei send_mode=0: Intervall (in 5-min Schritten)
     uint8_t send_fixed_hour;                     ///< nur bei send_mode=1: Stunde (0–23)
@@ -151,7 +183,7 @@ typedef struct
     uint8_t meas_interval_5min;                  ///< nur bei meas_mode=0: Intervall (in 5-min Schritten)
     uint8_t meas_fixed_hour;                     ///< nur bei meas_mode=1: Stunde (0–23)
     uint8_t meas_fixed_minute;                   ///< nur bei meas_mode=1: Minute (0–59)
-    float cool_down_threshold;                   ///< Temperatur-Schwelle
+    temp_q4_t cool_down_threshold;               ///< Temperatur-Schwelle in 1/16 °C (fester Platz: float in °C)
     uint8_t device_id_msb;                       ///< Eindeutige ID
     uint8_t device_id_lsb;                       ///< Eindeutige ID
     int32_t offset_hz;                           ///< RF-Freq. Offset @23°C
@@ -166,11 +198,19 @@ settings_t *settings_get(void);
 
 /**
  * @brief Lädt Einstellungen aus EEPROM (mit CRC-Validierung)
+ *
+ * Einstellungen in einem älteren Layout werden übernommen und im aktuellen
+ * Layout neu gespeichert; Defaults nur, wenn nichts Gültiges gefunden wird.
+ * Nur der erste Aufruf liest den EEPROM; danach wird das validierte Abbild
+ * aus dem RAM übernommen (verwirft ungespeicherte Änderungen).
  */
 void settings_load(void);
 
 /**
  * @brief Speichert aktuelle Einstellungen ins EEPROM
+ *
+ * Schreibt nur, wenn sich die Einstellungen seit dem letzten Laden oder
+ * Speichern geändert haben.
  */
 void settings_save(void);
 
@@ -19,6 +19,9 @@ void storage_eeprom_unlock(void);
 
 /**
  * @brief Schreibt Daten in den EEPROM.
+ *
+ * Bytes, die bereits den Zielwert haben, werden nicht programmiert;
+ * ausgerichtete 4-Byte-Gruppen werden im Wortmodus geschrieben.
  * @param address Startadresse im EEPROM
  * @param data Zeiger auf die zu schreibenden Bytes
  * @param len Anzahl der zu schreibenden Bytes
@@ -34,6 +37,78 @@ void storage_write_eeprom(uint16_t address, const uint8_t* data, uint16_t len);
  */
 bool storage_read_eeprom(uint16_t address, uint8_t* data, uint16_t len);
 
+// -----------------------------------------------------------------------------
+// EEPROM-Journal (rotierende Slots mit Sequenznummer und CRC)
+// -----------------------------------------------------------------------------
+
+/// Aufteilung des Daten-EEPROM (0x000..0x27F). 0x000..0x07F: bisherige feste Plätze.
+#define EEPROM_ADDR_JOURNAL_SETTINGS 0x080 ///< Einstellungen (settings.c), 10 Slots à 32 Byte
+#define EEPROM_JOURNAL_SETTINGS_SLOTS 10
+#define EEPROM_ADDR_JOURNAL_MODE 0x1D0 ///< Betriebsmodus, 16 Slots à 4 Byte
+#define EEPROM_JOURNAL_MODE_SLOTS 16
+#define EEPROM_ADDR_JOURNAL_BATCH 0x210 ///< Beginn-/Ende-Einträge von flash_commit_staged(), 8 Slots à 12 Byte
+#define EEPROM_JOURNAL_BATCH_SLOTS 8
+#define EEPROM_ADDR_END 0x280 ///< hinter dem letzten Byte des Daten-EEPROM
+// frei: 0x1C0..0x1CF, 0x270..0x27F
+
+/// Slotgröße: Sequenznummer + Nutzdaten + CRC-8, auf 4 Byte aufgerundet (Wortmodus)
+#define EEPROM_JOURNAL_SLOT_SIZE(len) ((uint16_t)(((len) + 2 + 3) & ~3))
+#define EEPROM_JOURNAL_MAX_LEN 30 ///< maximale Nutzdatenlänge eines Journals
+
+/**
+ * @brief Beschreibung und Laufzustand eines EEPROM-Journals.
+ *
+ * Mit EEPROM_JOURNAL() statisch anlegen; head/seq werden beim ersten Zugriff
+ * durch Suche nach dem neuesten gültigen Slot bestimmt.
+ */
+typedef struct
+{
+    uint16_t address; ///< Startadresse im EEPROM
+    uint8_t len;      ///< Nutzdatenlänge in Byte
+    uint8_t slots;    ///< Anzahl Slots (max. 127)
+    uint8_t head;     ///< Slot des neuesten Eintrags
+    uint8_t seq;      ///< Sequenznummer des neuesten Eintrags
+    bool scanned;     ///< head/seq bestimmt
+    bool valid;       ///< gültiger Eintrag vorhanden
+} eeprom_journal_t;
+
+#define EEPROM_JOURNAL(address, len, slots) {(address), (len), (slots), 0, 0, FALSE, FALSE}
+
+/// Prüft beim Übersetzen, dass ein Slot in den Slotpuffer (EEPROM_JOURNAL_MAX_LEN)
+/// passt und alle Slots vor end liegen. SDCC kennt kein _Static_assert.
+#define EEPROM_JOURNAL_ASSERT(name, address, len, slots, end)                                   \
+    typedef char name##_journal_fits[(EEPROM_JOURNAL_SLOT_SIZE(len) <=                          \
+                                          EEPROM_JOURNAL_SLOT_SIZE(EEPROM_JOURNAL_MAX_LEN) &&    \
+                                      (address) + (slots) * EEPROM_JOURNAL_SLOT_SIZE(len) <= (end)) \
+                                         ? 1 : -1]
+
+/**
+ * @brief Liest den neuesten gültigen Eintrag eines Journals.
+ * @param j Journal
+ * @param[out] data Zielpuffer (j->len Byte)
+ * @return TRUE wenn ein gültiger Eintrag existiert, sonst FALSE
+ */
+bool storage_journal_read(eeprom_journal_t* j, uint8_t* data);
+
+/**
+ * @brief Schreibt einen neuen Eintrag in den nächsten Slot des Journals.
+ *
+ * Der bisherige Eintrag bleibt erhalten, bis der neue vollständig (inkl. CRC)
+ * geschrieben ist.
+ * @param j Journal
+ * @param data Nutzdaten (j->len Byte)
+ */
+void storage_journal_write(eeprom_journal_t* j, const uint8_t* data);
+
+/**
+ * @brief Löscht alle Slots eines Journals (0x00, nie gültig).
+ *
+ * Für die Übernahme aus einem älteren Speicherplatz: danach kann kein Rest
+ * eines früheren Eintrags mehr als neuester gelten.
+ * @param j Journal
+ */
+void storage_journal_clear(eeprom_journal_t* j);
+
 // -----------------------------------------------------------------------------
 // Persistenter Betriebsmodus
 // -----------------------------------------------------------------------------
@@ -73,26 +148,192 @@ bool load_device_id(uint8_t* out);
 // Externer Flash-Datenspeicher
 // -----------------------------------------------------------------------------
 
+/**
+ * @brief Stellt beim Systemstart den Schreibkopf des Flash-Logs wieder her.
+ *
+ * Bestimmt über die Seitenköpfe der Sektoren die zuletzt beschriebene Seite
+ * und den ältesten gespeicherten Datensatz und zählt die belegten Slots.
+ * Gingen gepufferte Datensätze durch Reset oder Brownout verloren, erhält der
+ * nächste Datensatz RECORD_FLAG_DATA_LOST. Muss nach der Flash-Initialisierung
+ * (ggf. Chip-Erase) und vor dem ersten Schreibzugriff aufgerufen werden.
+ */
+void storage_init(void);
+
 /**
  * @brief Schreibt einen Datensatz (record_t) in den Flash.
+ *
+ * Der erste Datensatz einer Seite wird im gepackten 5-Byte-Format abgelegt
+ * (20 Bit Zeitstempel, CRC4, 12 Bit Temperatur, 4 Bit Flags), alle weiteren
+ * als bitgepackte Differenz zum Vorgänger. Der Datensatz wird zunächst nur im
+ * RAM gepuffert und blockweise (FLASH_WRITE_CHUNK_BYTES) programmiert, siehe
+ * storage_flush().
  * @param rec Zeiger auf Datensatz
  * @return TRUE bei Erfolg, FALSE bei Fehler
  */
 bool flash_write_record(const record_t* rec);
 
+/**
+ * @brief Programmiert alle im RAM gepufferten Datensätze ins Flash.
+ *
+ * Vor Abschnitten aufrufen, in denen ein Verlust gepufferter Datensätze nicht
+ * hinnehmbar ist (z. B. nach dem Übertragen des Hochtemperaturpuffers oder vor
+ * einem Moduswechsel). Gepufferte Datensätze sind über Lesefunktionen und
+ * flash_get_count() bereits vorher sichtbar.
+ * @return TRUE bei Erfolg oder wenn nichts gepuffert war, sonst FALSE
+ */
+bool storage_flush(void);
+
+/**
+ * @brief Lagert kompakte Datensätze in den Zwischenspeicher (Flash-Sektor 0) aus.
+ *
+ * Programmiert fortlaufend in Blöcken von bis zu FLASH_WRITE_CHUNK_BYTES. Ist
+ * der Zwischenspeicher voll, wird sein Inhalt zuvor mit flash_commit_staged()
+ * ins Log übernommen; die Länge einer Auslagerungsphase ist so nur durch das
+ * Log begrenzt. Die Datensätze erscheinen erst nach der Übernahme im Log.
+ * @param base_ts Basiszeitstempel der Reihe
+ * @param flags Flags aller Datensätze
+ * @param recs Zeiger auf das erste von count Datensätzen
+ * @param count Anzahl der Datensätze
+ * @return TRUE bei Erfolg, FALSE bei Flash-Fehler oder vollem Log
+ */
+bool flash_stage_records(timestamp_t base_ts, uint8_t flags, const record_compact_t* recs, uint16_t count);
+
+/**
+ * @brief Anzahl der Datensätze im Zwischenspeicher.
+ */
+uint16_t flash_staged_count(void);
+
+/**
+ * @brief Übernimmt den Zwischenspeicher mit Zwei-Phasen-Commit ins Log.
+ *
+ * Legt vor dem Übertragen einen Beginn-Eintrag (erster Index, Anzahl, CRC) im
+ * EEPROM ab, programmiert die Datensätze (inkl. storage_flush()), löscht den
+ * Zwischenspeicher und schließt mit einem Ende-Eintrag ab. Ein unterbrochener
+ * Stapel wird beim nächsten Start von storage_recover_commit() behandelt.
+ * @return TRUE wenn alle Datensätze im Log stehen (oder nichts ausgelagert war)
+ */
+bool flash_commit_staged(void);
+
+/**
+ * @brief Lagert kompakte Datensätze aus und übernimmt den Zwischenspeicher ins Log.
+ *
+ * Entspricht flash_stage_records() gefolgt von flash_commit_staged(); bereits
+ * ausgelagerte Datensätze werden davor eingereiht.
+ * @param base_ts Basiszeitstempel der Reihe
+ * @param flags Flags aller Datensätze
+ * @param recs Zeiger auf das erste von count Datensätzen
+ * @param count Anzahl der Datensätze
+ * @return TRUE wenn alle Datensätze im Log stehen, sonst FALSE
+ */
+bool flash_commit_records(timestamp_t base_ts, uint8_t flags, const record_compact_t* recs, uint16_t count);
+
+/**
+ * @brief Setzt eine beim Stromausfall unterbrochene Übernahme fort oder verwirft sie.
+ *
+ * Liegt der Stapel noch im Zwischenspeicher, werden die fehlenden Datensätze
+ * nachgetragen. Ist der Zwischenspeicher schon gelöscht und stehen alle
+ * Datensätze mit passender CRC im Log, wird nur der Ende-Eintrag nachgeholt.
+ * Andernfalls wird der Stapel als abgebrochen markiert und der nächste
+ * geschriebene Datensatz trägt RECORD_FLAG_DATA_LOST. Nach storage_init()
+ * aufrufen.
+ * @return FALSE wenn ein unvollständiger Stapel verworfen wurde, sonst TRUE
+ */
+bool storage_recover_commit(void);
+
 /**
  * @brief Liest einen Datensatz aus dem Flash.
  * @param index Index des Datensatzes (0 = ältester)
  * @param[out] out Zeiger auf Zielstruktur
  * @return TRUE bei Erfolg, FALSE bei ungültigem Index oder CRC-Fehler
  */
-bool flash_read_record(uint16_t index, record_t* out);
+bool flash_read_record(uint32_t index, record_t* out);
+
+/// Eine Log-Seite als Übertragungseinheit, kodiert wie im Flash (Seitenkopf + Datensätze)
+typedef struct
+{
+    uint16_t page;  ///< intern: Seite im Ring
+    uint32_t first; ///< Nummer des ersten Datensatzes der Seite
+    uint32_t end;   ///< Nummer hinter dem letzten Datensatz der Seite
+    uint16_t len;   ///< belegte Bytes ab Seitenanfang
+} flash_block_t;
+
+/**
+ * @brief Öffnet die Log-Seite, die den Datensatz index enthält, zum blockweisen Lesen.
+ *
+ * Die Seite wird nicht dekodiert: flash_block_read() liefert die Bytes so, wie
+ * sie im Flash stehen, der Empfänger dekodiert sie anhand des Seitenkopfs
+ * (Format und Nummer des ersten Datensatzes). Seiten mit falscher Daten-CRC
+ * werden übersprungen. Der Flash bleibt bis flash_block_close() geöffnet;
+ * ein erneutes Öffnen beendet die vorige Sitzung.
+ * @param index Index eines Datensatzes (flash_get_first() .. flash_get_count() - 1)
+ * @param[out] blk Beschreibung der Seite
+ * @return TRUE bei Erfolg, FALSE bei ungültigem Index
+ */
+bool flash_block_open(uint32_t index, flash_block_t* blk);
+
+/**
+ * @brief Wechselt auf die nächste Log-Seite mit gültigem Kopf und gültiger Daten-CRC.
+ * @param[in,out] blk zuletzt geöffnete Seite
+ * @return FALSE, wenn blk bereits die neueste Seite war
+ */
+bool flash_block_next(flash_block_t* blk);
+
+/**
+ * @brief Liest Bytes einer Log-Seite direkt in den Puffer des Aufrufers.
+ *
+ * Kopiert aus dem beim Öffnen gelesenen und geprüften Seitenabbild (die
+ * Kopfseite aus ihrem RAM-Abbild); nur beim Wechsel zwischen Seiten wird
+ * die Seite erneut gelesen.
+ * @param blk geöffnete Seite
+ * @param offset Byte-Offset ab Seitenanfang
+ * @param[out] out Zielpuffer für max Bytes
+ * @param max Maximale Anzahl
+ * @return Anzahl gelesener Bytes, 0 hinter blk->len oder bei falscher Daten-CRC
+ */
+uint8_t flash_block_read(const flash_block_t* blk, uint16_t offset, uint8_t* out, uint8_t max);
+
+/**
+ * @brief Beendet das blockweise Lesen und gibt den Flash frei.
+ */
+void flash_block_close(void);
+
+/**
+ * @brief Gibt die laufende Nummer hinter dem neuesten Datensatz zurück.
+ *
+ * Entspricht der Anzahl jemals geschriebener Datensätze. Gespeichert sind die
+ * Datensätze flash_get_first() bis flash_get_count() - 1.
+ * @return Index des nächsten zu schreibenden Datensatzes
+ */
+uint32_t flash_get_count(void);
+
+/**
+ * @brief Gibt den Index des ältesten noch gespeicherten Datensatzes zurück.
+ *
+ * Das Log läuft als Ringpuffer über den Flash; ältere Datensätze wurden nach
+ * ihrer Übertragung gelöscht.
+ * @return Index des ältesten lesbaren Datensatzes
+ */
+uint32_t flash_get_first(void);
+
+/**
+ * @brief Bestätigt alle Datensätze vor upto als übertragen.
+ *
+ * Sektoren, deren Datensätze vollständig bestätigt sind, werden im Flash
+ * markiert und dürfen von storage_maintenance() gelöscht werden. Nicht
+ * bestätigte Datensätze werden nie verworfen.
+ * @param upto Index des ersten nicht übertragenen Datensatzes
+ */
+void flash_ack_records(uint32_t upto);
 
 /**
- * @brief Gibt die Anzahl aktuell gespeicherter Datensätze im Flash zurück.
- * @return Anzahl gültiger Datensätze
+ * @brief Löscht Sektoren vor dem Schreibkopf im Voraus.
+ *
+ * Hält bis zu zwei gelöschte Sektoren bereit, damit beim Schreiben von
+ * Datensätzen nie gelöscht werden muss. Ein Sektorlöschen dauert bis zu
+ * einige hundert Millisekunden; daher nur in ansonsten ungenutzten
+ * Wachphasen aufrufen (z. B. nach dem Datentransfer), nicht im Messpfad.
  */
-//uint16_t flash_get_count(void);
+void storage_maintenance(void);
 
 // -----------------------------------------------------------------------------
 // Interner Pufferspeicher (z. B. bei Stromausfall oder High-Temp)
@@ -0,0 +1,198 @@
+#ifndef UPLINK_H
+#define UPLINK_H
+
+#include "stm8s.h"
+#include <stdint.h>
+#include "config/config.h"
+#include "modules/storage.h"
+
+/// @file uplink.h
+/// @brief Datenrahmen für die Übertragung des Flash-Logs an das Gateway
+
+/**
+ * Aufbau eines Rahmens UPLINK_HEADER_LOG_BLOCK bzw. UPLINK_HEADER_LOG_BLOCK_LAST:
+ *
+ * | Byte  | Inhalt                                               |
+ * |-------|------------------------------------------------------|
+ * | 0     | UPLINK_HEADER_LOG_BLOCK                              |
+ * | 1     | Sequenznummer des Rahmens (gleich bei Wiederholung)  |
+ * | 2-3   | Geräte-ID (MSB, LSB)                                 |
+ * | 4-7   | Nummer des ersten Datensatzes der Seite (MSB zuerst) |
+ * | 8     | Byte-Offset des Ausschnitts in der Seite             |
+ * | 9     | Anzahl Bytes n des Ausschnitts                       |
+ * | 10-   | n Bytes der Seite ab Offset, unverändert aus dem Flash |
+ * | 10+n  | CRC-8 (crc8_update, Start 0) über alle Bytes davor   |
+ *
+ * Der Ausschnitt ab Offset 0 enthält den Seitenkopf mit Format und
+ * Sequenznummer; das Gateway setzt die Seite zusammen und dekodiert sie.
+ * Wiederholte Rahmen erkennt es an der Sequenznummer.
+ *
+ * Rahmen werden fensterweise ohne Einzelquittung gesendet. Auf den letzten
+ * Rahmen eines Sendedurchgangs (UPLINK_HEADER_LOG_BLOCK_LAST) antwortet das
+ * Gateway mit einer Sammelquittung (8 Byte, wie die übrigen Downlinks):
+ *
+ * | Byte | Inhalt                                                   |
+ * |------|----------------------------------------------------------|
+ * | 0    | DOWNLINK_HEADER                                          |
+ * | 1    | CMD_WINDOW_ACK                                           |
+ * | 2-3  | Geräte-ID (MSB, LSB)                                     |
+ * | 4    | Sequenznummer s des quittierten Rahmens (..._LAST)       |
+ * | 5-6  | Bitmap (MSB zuerst): Bit i = Rahmen s - i empfangen      |
+ * | 7    | zugewiesener Sendeslot + 1, 0 = keine Zuweisung          |
+ *
+ * Das Gateway braucht die Fenstergröße daher nicht zu kennen, es merkt sich
+ * nur die zuletzt empfangenen 16 Sequenznummern.
+ *
+ * Mit PING_ACK_INLINE_RTC beginnt eine Sitzung mit dem Ping
+ * UPLINK_HEADER_PING:
+ *
+ * | Byte | Inhalt                                               |
+ * |------|------------------------------------------------------|
+ * | 0    | UPLINK_HEADER_PING                                   |
+ * | 1-2  | Geräte-ID (MSB, LSB)                                 |
+ * | 3    | UPLINK_PING_ACTIVATION oder UPLINK_PING_DATA_TRANSFER |
+ * | 4-7  | Anzahl angekündigter Datensätze (MSB zuerst)         |
+ * | 8    | CRC-8 (crc8_update, Start 0) über alle Bytes davor   |
+ *
+ * Das Gateway quittiert mit der Uhrzeit (8 Byte):
+ *
+ * | Byte | Inhalt                                                   |
+ * |------|----------------------------------------------------------|
+ * | 0    | DOWNLINK_HEADER                                          |
+ * | 1    | CMD_ACK_SET_RTC                                          |
+ * | 2-3  | Geräte-ID (MSB, LSB)                                     |
+ * | 4-7  | Uhrzeit (MSB zuerst), 0 = Uhr nicht stellen:             |
+ * |      | Bit 31-26 Jahr-2000, 25-22 Monat, 21-17 Tag,             |
+ * |      | 16-12 Stunde, 11-6 Minute, 5-0 Sekunde                   |
+ *
+ * Eine Bestätigung des Sensors entfällt: das Gateway wertet den ersten
+ * Datenrahmen (bzw. nach der Aktivierung den nächsten Ping) als Bestätigung
+ * und wiederholt die Quittung, solange derselbe Ping erneut eintrifft.
+ */
+#define UPLINK_FRAME_SIZE MAX_UPLINK_PACKET_SIZE
+#define UPLINK_BLOCK_HEADER_SIZE 10
+#define UPLINK_BLOCK_DATA_MAX (UPLINK_FRAME_SIZE - UPLINK_OVERHEAD_BYTES)
+#define UPLINK_TX_TIMEOUT_MS 100
+#define UPLINK_RX_SLICE_MS 10 ///< Empfangsfenster je Abfrage beim Warten auf eine Quittung
+#define UPLINK_BITRATE_BPS 4800UL   ///< Bitrate nach RFM69_open(), nur für die Abschätzung der Funkzeit
+#define UPLINK_AIR_OVERHEAD_BYTES 9 ///< Präambel, Sync-Wort, Längenbyte und CRC je RFM69-Paket
+#define UPLINK_RSSI_HYSTERESIS_DB 3 ///< Abstand über DT_XFER_RSSI_TARGET_DBM, ab dem die Leistung sinkt
+#define UPLINK_PING_SIZE 9
+#define UPLINK_PING_ACTIVATION 0
+#define UPLINK_PING_DATA_TRANSFER 1
+#define UPLINK_RTC_INVALID 0xFFFF   ///< uplink_rtc_t.year bei unplausibler Uhrzeit in CMD_ACK_SET_RTC
+
+/// Uhrzeit aus CMD_ACK_SET_RTC
+typedef struct
+{
+    uint16_t year;  ///< Kalenderjahr, 0 = keine Uhrzeit, UPLINK_RTC_INVALID = unplausibel
+    uint8_t month;  ///< 1..12
+    uint8_t day;    ///< 1..31
+    uint8_t hour;   ///< 0..23
+    uint8_t minute; ///< 0..59
+    uint8_t second; ///< 0..59
+} uplink_rtc_t;
+
+/**
+ * @brief Sendet einen Ausschnitt einer Log-Seite als ein Funkrahmen.
+ *
+ * Die Bytes werden mit flash_block_read() direkt hinter den Rahmenkopf
+ * kopiert und ohne Dekodieren übertragen. Das Funkmodul muss
+ * geöffnet sein.
+ * @param blk geöffnete Seite (flash_block_open())
+ * @param offset Byte-Offset in der Seite, Vielfaches von UPLINK_BLOCK_DATA_MAX
+ * @param seq Sequenznummer des Rahmens
+ * @param ack_request TRUE: letzter Rahmen des Sendedurchgangs, Gateway quittiert das Fenster
+ * @return Anzahl übertragener Bytes der Seite, 0 bei Fehler oder hinter blk->len
+ */
+uint8_t uplink_send_block(const flash_block_t* blk, uint16_t offset, uint8_t seq, bool ack_request);
+
+/**
+ * @brief Sendet den Ping UPLINK_HEADER_PING (PING_ACK_INLINE_RTC).
+ *
+ * Das Funkmodul muss geöffnet sein.
+ * @param kind UPLINK_PING_ACTIVATION oder UPLINK_PING_DATA_TRANSFER
+ * @param num_records Anzahl angekündigter Datensätze (Aktivierung: 0)
+ */
+void uplink_send_ping(uint8_t kind, uint32_t num_records);
+
+/**
+ * @brief Wartet auf die Quittung CMD_ACK_SET_RTC eines Pings.
+ * @param timeout_ms maximale Wartezeit
+ * @param[out] rtc übermittelte Uhrzeit, rtc->year == 0 ohne Uhrzeit
+ * @return TRUE, wenn eine Quittung für dieses Gerät empfangen wurde
+ */
+bool uplink_wait_ping_ack(uint16_t timeout_ms, uplink_rtc_t* rtc);
+
+/**
+ * @brief Wartet auf die Sammelquittung (CMD_WINDOW_ACK) eines Fensters.
+ *
+ * Quittungen anderer Geräte oder früherer Fenster werden übergangen.
+ * Mit DT_XFER_TX_POWER_ADAPT wird die Sendeleistung danach angepasst: liegt
+ * das RSSI der Quittung mindestens UPLINK_RSSI_HYSTERESIS_DB über
+ * DT_XFER_RSSI_TARGET_DBM, sinkt sie um 1 dB, unter dem Ziel steigt sie um
+ * 1 dB. Bleibt die Quittung aus, gilt sofort wieder die volle Leistung.
+ * @param ack_seq Sequenznummer des Rahmens, der die Quittung angefordert hat
+ * @param timeout_ms maximale Wartezeit
+ * @param[out] received Bitmap der empfangenen Rahmen (Bit i = ack_seq - i)
+ * @return TRUE, wenn eine passende Quittung empfangen wurde
+ */
+bool uplink_wait_window_ack(uint8_t ack_seq, uint16_t timeout_ms, uint16_t* received);
+
+/**
+ * @brief Beginn einer Sitzung: setzt Funkzeit und Laufzeitschätzung zurück.
+ *
+ * Merkt sich die Sendeleistung nach RFM69_open() als volle Leistung der
+ * Sitzung. Das Funkmodul muss geöffnet sein.
+ */
+void uplink_session_start(void);
+
+/**
+ * @brief Ende einer Sitzung: stellt die volle Sendeleistung wieder her.
+ *
+ * Vor RFM69_close() aufrufen, damit andere Pakete nicht mit abgesenkter
+ * Leistung gesendet werden.
+ */
+void uplink_session_end(void);
+
+/**
+ * @brief Geschätzte Funkzeit seit uplink_session_start().
+ *
+ * Summe aus Sendedauer der Rahmen (Länge und UPLINK_BITRATE_BPS) und der
+ * Empfangszeit beim Warten auf Quittungen, in UPLINK_RX_SLICE_MS-Schritten.
+ * @return Funkzeit in ms
+ */
+uint32_t uplink_airtime_ms(void);
+
+/**
+ * @brief Vom Gateway zugewiesener Sendeslot (Byte 7 von CMD_WINDOW_ACK).
+ *
+ * Nur im RAM: nach einem Reset gilt bis zur nächsten Zuweisung wieder der
+ * Slot aus der Geräte-ID.
+ * @return Slot + 1, 0 = keine Zuweisung
+ */
+uint8_t uplink_assigned_slot(void);
+
+/**
+ * @brief ACK-Timeout aus den gemessenen Antwortzeiten der Sitzung.
+ *
+ * Geglättete Antwortzeit plus vierfache mittlere Abweichung (wie bei TCP),
+ * nach jeder verlorenen Quittung verdoppelt, begrenzt auf
+ * DT_XFER_ACK_TIMEOUT_MIN .. DT_XFER_ACK_TIMEOUT. Ohne Messung gilt
+ * DT_XFER_ACK_TIMEOUT. Gemessen wird in uplink_wait_window_ack().
+ * @return Timeout in ms
+ */
+uint16_t uplink_ack_timeout_ms(void);
+
+/**
+ * @brief Zufällige Wartezeit vor einer Wiederholung nach Verlusten.
+ *
+ * Obergrenze DT_XFER_BACKOFF_BASE_MS, je weiterem Verlust in Folge verdoppelt
+ * bis MAX_RESEND_DELAY_MS; gewartet wird zufällig zwischen halber und voller
+ * Obergrenze, damit sich Geräte nicht im Gleichtakt wiederholen.
+ * @param losses Anzahl Verluste in Folge (0: keine Wartezeit)
+ * @return Wartezeit in ms
+ */
+uint16_t uplink_backoff_ms(uint8_t losses);
+
+#endif
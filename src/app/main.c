@@ -24,7 +24,7 @@
 #include "periphery/system.h"
 #include "modules/settings.h"
 // #include "modules/storage_internal.h"
-//  #include "modules/storage.h"
+#include "modules/storage.h"
 //  #include "modules/rtc.h"
 //  #include "modules/interrupts_PCB_REV_3_1.h"
 #include "utility/debug.h"
@@ -66,10 +66,10 @@ void main(void)
 {
     system_init_phase_1(); ///< Systemkomponenten initialisieren
 
-    // TODO: For Debug -> remove
-    settings_set_default();
+#if defined(DEBUG_RESET_SETTINGS_AT_BOOT)
+    settings_set_default(); // setzt auch SETTINGS_FLAG_FLASH_ERASE_DONE zurück -> Chip-Erase
     settings_save();
-    ///////////////////////////////
+#endif
 
     settings_load();
     settings_t *settings = settings_get();
@@ -82,7 +82,6 @@ void main(void)
 #endif
         do_chip_erase = TRUE;
         settings->flags |= SETTINGS_FLAG_FLASH_ERASE_DONE;
-        settings->flash_record_count = 0;
         settings_save();
     }
     else
@@ -93,6 +92,8 @@ void main(void)
         nop();
     }
     system_init_phase_2(do_chip_erase, settings->offset_hz);
+    storage_init(); ///< Schreibkopf des Flash-Logs wiederherstellen
+    storage_maintenance(); ///< Sektoren vor dem Schreibkopf löschen (Start ist ohnehin kein Messpfad)
 #if defined(DEBUG_MAIN_C)
     DebugLn("=Sensor Main=");
 #endif
@@ -75,6 +75,15 @@ void state_init(void)
 #endif
     }
 
+    // Beim Stromausfall unterbrochene Übernahme des Hochtemperaturpuffers abschließen oder verwerfen
+    if (!storage_recover_commit())
+    {
+#if defined(DEBUG_STATE_MACHINE_C)
+        DebugLn("[STATE INIT] Hi-temp batch incomplete, rolled back.");
+#endif
+        nop();
+    }
+
     last_measurement_ts = 0;
     mode_transition_pending = FALSE;
 }
@@ -190,6 +199,8 @@ void state_transition(mode_t new_mode)
         break;
     }
 
+    storage_flush(); // gepufferte Datensätze vor dem Moduswechsel sichern
+
     next_mode = new_mode;
     mode_transition_pending = TRUE;
 }
@@ -4,6 +4,7 @@
 #include "modules/storage.h"
 #include "modules/rtc.h"
 #include "modules/packet_handler.h"
+#include "modules/uplink.h"
 #include "periphery/mcp7940n.h"
 #include "periphery/RFM69.h"
 #include "periphery/tmp126.h"
@@ -12,6 +13,15 @@
 #include "utility/delay.h"
 #include <string.h>
 
+/// Ein Datenrahmen des Sendefensters: Ausschnitt einer Log-Seite
+typedef struct
+{
+    flash_block_t blk; ///< Seite
+    uint16_t offset;   ///< Byte-Offset des Ausschnitts
+} dt_xfer_frame_t;
+
+static dt_xfer_frame_t dt_xfer_window[DT_XFER_WINDOW_FRAMES];
+
 void mode_data_transfer_run(void)
 {
 #if defined(DEBUG_MODE_DATA_TRANSFER)
@@ -19,7 +29,19 @@ void mode_data_transfer_run(void)
 #endif
     ///////////// Determine number of records to transfer
     settings_load();
-    uint32_t num_records = settings_get()->flash_record_count;
+    storage_flush(); // nur Datensätze übertragen, die einen Reset überstehen
+    settings_t *settings = settings_get();
+    uint32_t first_record = flash_get_first(); // ältere Datensätze sind übertragen und gelöscht
+    uint32_t stored_end = flash_get_count();
+
+    ///////////// Cursor beyond the log (flash erased): nothing of the log is confirmed
+    if (settings->transfer_acked_upto > stored_end)
+        settings->transfer_acked_upto = first_record;
+    ///////////// Only new records, or previous session stopped early: start at the cursor
+    if ((settings->transfer_mode == 1 || (settings->flags & SETTINGS_FLAG_TRANSFER_RESUME)) &&
+        settings->transfer_acked_upto > first_record)
+        first_record = settings->transfer_acked_upto;
+    uint32_t num_records = stored_end - first_record;
 #if defined(DEBUG_MODE_DATA_TRANSFER)
     DebugULong("[DTXFR]rec's:", num_records, "");
 #endif
@@ -34,33 +56,60 @@ void mode_data_transfer_run(void)
     float temp = TMP126_ReadTemperatureCelsius();
     TMP126_CloseForMeasurement();
 
-    RFM69_open(settings_get()->offset_hz, temp);
+    RFM69_open(settings->offset_hz, temp);
 
     //////////// Init retry counter, ack & cmd_announce flags
     uint8_t ping_retry = 0;
     bool ping_ack_ok = FALSE;
+#if PING_ACK_INLINE_RTC
+    uplink_rtc_t rtc;
+#else
     bool cmd_follows = FALSE;
+#endif
     bool rtc_success = FALSE;
+    uint32_t acked_upto = first_record; // all records before this one were acknowledged
 
     //////////// Send ping & wait-for-ack loop
+    uplink_session_start();
     while (!ping_ack_ok && ping_retry < MAX_DT_XFER_PING_SEND_RETRIES)
     {
+#if PING_ACK_INLINE_RTC
+        //////// Send ping for data transfer, ack carries the time
+        uplink_send_ping(UPLINK_PING_DATA_TRANSFER, num_records);
+        ping_ack_ok = uplink_wait_ping_ack(DT_XFER_ACK_TIMEOUT, &rtc);
+#else
         //////// Send ping for data transfer
         send_uplink_ping_for_data_transfer(DEVICE_ID_MSB, DEVICE_ID_LSB, num_records);
 
         //////// Check for ack
         ping_ack_ok = wait_for_ack_by_gateway(DT_XFER_ACK_TIMEOUT, &cmd_follows);
+#endif
 
         if (!ping_ack_ok)
         {
             ping_retry++;
-            delay(DT_XFER_PING_DELAY_BEFORE_RETRY);
+            delay(DT_XFER_PING_DELAY_BEFORE_RETRY + uplink_backoff_ms(ping_retry)); // jitter: nodes do not retry in lockstep
             continue;
         }
 
 #if defined(DEBUG_MODE_DATA_TRANSFER)
         DebugLn("[RCVD]AckByGtwy");
 #endif
+#if PING_ACK_INLINE_RTC
+        //////// Time in the ack: set RTC, the first data frame confirms it
+        if (rtc.year > 2040)
+        {
+            DebugLn("[FAIL]InvldCmd");
+            break;
+        }
+        if (rtc.year != 0)
+        {
+            rtc_set_date_time(rtc.year, rtc.month, rtc.day, rtc.hour, rtc.minute, rtc.second);
+            DebugLn("=RtcSetCompl=");
+        }
+        rtc_success = TRUE;
+        break;
+#else
         if (!cmd_follows)
         {
             rtc_success = TRUE; // If not TRUE -> no Data Transfer will happen
@@ -129,51 +178,122 @@ void mode_data_transfer_run(void)
             break;
         }
         break;
+#endif
     }
 
     //////////////////// Ping and RTC set ok? --> Data Transfer
     if (rtc_success)
     {
-        //////////////// Open Flash Module
-        Flash_Open();
+        //////////////// Data transfer main loop (log pages are sent as stored in flash, the gateway decodes them)
+        flash_block_t blk;
+        uint16_t offset = 0;
+        uint32_t end_record = first_record + num_records;
+        uint8_t base_seq = 0; // Sequenznummer des ersten Rahmens im Fenster
+        bool more = (num_records > 0) && flash_block_open(first_record, &blk);
+        bool budget_left = TRUE;
+        uint8_t losses = 0; // rounds in a row without any ack
 
-        //////////////// Data transfer main loop
-        for (uint32_t idx = 0; idx < num_records; idx++)
+        while (more && budget_left)
         {
-            //////////// Get Flash record
-            record_t rec;
-            uint32_t address = flash_get_record_address(idx);
-            uint8_t tmp[sizeof(record_t)];
-            Flash_ReadData(address, tmp, sizeof(record_t));
-            memcpy(&rec, tmp, sizeof(record_t));
-
-            //////////// Send Data Packet, wait for ack loop evt. resend
-            uint8_t retries = 0;
-            bool pkt_ack = FALSE;
-
-            //////////// Send/receive loop
-            while (!pkt_ack && retries < DT_XFER_MAX_DT_PACKET_SEND_RETRIES)
+            //////////// Fill window with the next page sections
+            uint8_t count = 0;
+            while (more && count < DT_XFER_WINDOW_FRAMES && blk.first < end_record)
             {
-                send_uplink_data_packet(DEVICE_ID_MSB, DEVICE_ID_LSB, rec.temperature, rec.timestamp);
-
-                //////// Check for ack
-                pkt_ack = wait_for_ack_by_gateway(DT_XFER_ACK_TIMEOUT, &cmd_follows);
-                if (!pkt_ack)
-                    retries++;
+                dt_xfer_window[count].blk = blk;
+                dt_xfer_window[count].offset = offset;
+                count++;
+                offset += UPLINK_BLOCK_DATA_MAX;
+                if (offset >= blk.len)
+                {
+                    offset = 0;
+                    more = flash_block_next(&blk);
+                }
+            }
+            if (count == 0)
+                break;
 
+            //////////// Send missing frames back-to-back, one bitmap ack per round
+            uint16_t pending = (uint16_t)((1UL << count) - 1);
+            uint8_t rounds = 0;
+            while (pending && rounds < DT_XFER_MAX_DT_PACKET_SEND_RETRIES)
+            {
+                //////// Airtime budget used up: stop, the next session resumes at the cursor
+                if (uplink_airtime_ms() >= DT_XFER_SESSION_BUDGET_MS)
+                {
 #if defined(DEBUG_MODE_DATA_TRANSFER)
-                if (pkt_ack)
-                    DebugULong("[DTXFR]rec.", idx, " snt");
-                else
-                    DebugULong("[DTXFR]rec.", idx, " err");
+                    DebugLn("[DTXFR]budget");
 #endif
+                    budget_left = FALSE;
+                    break;
+                }
+                uint8_t last = count - 1;
+                while (!(pending & (1U << last)))
+                    last--;
+                for (uint8_t i = 0; i <= last; i++)
+                {
+                    if (pending & (1U << i))
+                        uplink_send_block(&dt_xfer_window[i].blk, dt_xfer_window[i].offset, (uint8_t)(base_seq + i), i == last);
+                }
+
+                //////// Check for ack (bit i = frame last - i), a round without progress counts as retry
+                uint16_t received = 0;
+                uint16_t before = pending;
+                if (uplink_wait_window_ack((uint8_t)(base_seq + last), uplink_ack_timeout_ms(), &received))
+                {
+                    losses = 0;
+                    for (uint8_t i = 0; i <= last; i++)
+                    {
+                        if (received & (1U << (last - i)))
+                            pending &= (uint16_t)~(1U << i);
+                    }
+                }
+                else
+                {
+                    //////// No ack at all: back off with jitter before the next round
+                    if (losses < 0xFF)
+                        losses++;
+                    delay(uplink_backoff_ms(losses));
+                }
+                if (pending == before)
+                    rounds++;
+            }
+
+            //////////// Pages whose frames are all acked (without gap) are transferred
+            for (uint8_t i = 0; i < count && !(pending & (1U << i)); i++)
+            {
+                const dt_xfer_frame_t *f = &dt_xfer_window[i];
+                if (f->offset + UPLINK_BLOCK_DATA_MAX >= f->blk.len)
+                    acked_upto = (f->blk.end < end_record) ? f->blk.end : end_record;
             }
+#if defined(DEBUG_MODE_DATA_TRANSFER)
+            DebugULong("[DTXFR]acked:", acked_upto, "");
+#endif
 
-            /////////////// Close Flash and RFM
+            //////////// Frames still missing: link is gone (or budget used up), stop here
+            if (pending)
+                break;
+            base_seq += count;
         }
-        Flash_Close();
+        flash_block_close();
     }
+    uplink_session_end(); // restore full TX power before the radio is handed back
     RFM69_close();
+
+    //////////////// Persist cursor (only written on change), release transferred sectors, erase ahead while awake anyway
+    if (acked_upto > settings->transfer_acked_upto)
+        settings->transfer_acked_upto = acked_upto;
+    //////////////// Resume only after a data phase that stopped early (budget, lost frames); no ping ack: flag unchanged
+    if (rtc_success)
+    {
+        if (acked_upto < first_record + num_records)
+            settings->flags |= SETTINGS_FLAG_TRANSFER_RESUME;
+        else
+            settings->flags &= (uint8_t)~SETTINGS_FLAG_TRANSFER_RESUME;
+    }
+    settings_save();
+    flash_ack_records(acked_upto);
+    storage_maintenance();
+
     state_transition(MODE_OPERATIONAL);
     return;
 }
\ No newline at end of file
@@ -19,12 +19,14 @@
 #include <string.h>
 
 #define DEV_HI_TEMP_SKIP_AFTER 3
-#define HI_TEMP_RAM_BUFFER_SIZE 72
+#define HI_TEMP_RAM_BUFFER_SIZE 216 // compact records (3 bytes each), same RAM as 72 record_t
+#define HI_TEMP_RECORD_FLAGS 0x01   // 0x01 = valid value, 0x00 =error
 
 volatile bool mode_hi_temp_measurement_alert_triggered = FALSE;
 static uint8_t dev_hi_temp_counter = 0;
-static record_t hi_temp_buffer[HI_TEMP_RAM_BUFFER_SIZE];
+static record_compact_t hi_temp_buffer[HI_TEMP_RAM_BUFFER_SIZE];
 static uint8_t hi_temp_buffer_index = 0;
+static timestamp_t hi_temp_buffer_base = 0; // timestamp of hi_temp_buffer[0]
 
 void mode_high_temperature_run(void)
 {
@@ -32,17 +34,17 @@ void mode_high_temperature_run(void)
     DebugLn("=HI_TMP=");
 #endif
 
-    ///////////// Resetting index RAM Buffer for data records in Hi-Temp mode (no access to flash in hi-temp mode)
+    ///////////// Resetting index RAM Buffer for data records in Hi-Temp mode (full buffers are spilled to the flash staging area)
     hi_temp_buffer_index = 0;
     ///////////// Clearing buffer
     memset(hi_temp_buffer, 0, sizeof(hi_temp_buffer));
 
     ///////////// Loading settings
     settings_t *settings = settings_get();
-    float threshold = settings->cool_down_threshold;
+    temp_q4_t threshold = settings->cool_down_threshold; // 1/16 °C
     uint8_t interval_min = settings->high_temp_measurement_interval_5min * 5;
 #if defined(DEBUG_MODE_HI_TEMP)
-    DebugFVal("[HITMP]LoTmpThre=", threshold, "");
+    DebugFVal("[HITMP]LoTmpThre=", TEMP_Q4_TO_C(threshold), "");
 #endif
 
     ///////////// Configuring RTC_WAKE pin for EXTI
@@ -57,25 +59,43 @@ void mode_high_temperature_run(void)
     {
         ///////////// Measure Temperature
         TMP126_OpenForMeasurement();
-        float temp = TMP126_ReadTemperatureCelsius();
+        float temp_c = TMP126_ReadTemperatureCelsius();
         TMP126_CloseForMeasurement();
+        temp_q4_t temp = temp_q4_from_c(temp_c); // ab hier nur noch Ganzzahl
+        bool temp_valid = (temp >= TEMP_Q4(TEMP_C_MIN) && temp <= TEMP_Q4(TEMP_C_MAX));
 #if defined(DEBUG_MODE_HI_TEMP)
-        DebugFVal("[HITMP]RdTmp=", temp, "");
+        DebugFVal("[HITMP]RdTmp=", TEMP_Q4_TO_C(temp), "");
 #endif
 
-        ///////////// Creating data record
-        record_t rec;
-        rec.timestamp = rtc_get_timestamp(); // 5-min Ticks
-        rec.temperature = temp;
-        rec.flags = 0x01; // 0x01 = valid value, 0x00 =error
-                          // DebugUVal("[MODE_HI_TEMP] rec.timestamp   = ", rec.timestamp, "x5 min");
-                          //  DebugUVal("[MODE_HI_TEMP] rec.temperature = ", rec.temperature, "degC");
-                          // DebugUVal("[MODE_HI_TEMP] rec.flags       = ", rec.flags, "(1 = ok)");
+        timestamp_t now = rtc_get_timestamp(); // 5-min Ticks
 
-        ///////////// Store data record in RAM (array)
-        if (hi_temp_buffer_index < HI_TEMP_RAM_BUFFER_SIZE)
+        ///////////// RAM buffer full or time offset out of range: spill it to the flash staging area (sector 0)
+        if (hi_temp_buffer_index > 0 &&
+            (hi_temp_buffer_index >= HI_TEMP_RAM_BUFFER_SIZE || now - hi_temp_buffer_base > 0xFF))
         {
-            hi_temp_buffer[hi_temp_buffer_index++] = rec;
+            if (flash_stage_records(hi_temp_buffer_base, HI_TEMP_RECORD_FLAGS, hi_temp_buffer, hi_temp_buffer_index))
+                hi_temp_buffer_index = 0;
+#if defined(DEBUG_MODE_HI_TEMP)
+            else
+                DebugLn("[HITMP]SpillErr");
+            DebugUVal("[HITMP]Staged=", flash_staged_count(), "");
+#endif
+        }
+
+        ///////////// Store compact data record in RAM (array)
+        if (hi_temp_buffer_index == 0)
+            hi_temp_buffer_base = now;
+        if (!temp_valid)
+        {
+#if defined(DEBUG_MODE_HI_TEMP)
+            DebugLn("[HITMP]tmp meas err"); // Messung verworfen, nächste planmäßig
+#endif
+        }
+        else if (hi_temp_buffer_index < HI_TEMP_RAM_BUFFER_SIZE && now - hi_temp_buffer_base <= 0xFF)
+        {
+            hi_temp_buffer[hi_temp_buffer_index].ts_offset = (uint8_t)(now - hi_temp_buffer_base);
+            hi_temp_buffer[hi_temp_buffer_index].temp_q4 = temp;
+            hi_temp_buffer_index++;
         }
         else
         {
@@ -98,74 +118,27 @@ void mode_high_temperature_run(void)
             DebugLn("[HITMP][DEV]ThresIgnored>GoTo Copy&Chng Mode");
 #endif
             temp = threshold - 1; // Schwellenwert künstlich unterschreiten
+            temp_valid = TRUE;
         }
 #endif
 
         ///////////// Check if temperature is below threshold
-        if (temp < threshold)
+        if (temp_valid && temp < threshold)
         {
 ///////////// Copy data from RAM --> Ext. Flash
 #if defined(DEBUG_MODE_HI_TEMP)
             DebugLn("[HITMP]Tmp<thres->Copy dt & chng mode");
 #endif
 
-            /// Adress in flash, calculation in for loop.
-            uint32_t address;
-            uint8_t size_record = sizeof(record_t);
-
-            Flash_Open();
-            for (uint16_t i = 0; i < hi_temp_buffer_index; i++)
-            {
-                /// Compute adress in flash, taking page limits into account.
-                address = flash_get_record_address(settings->flash_record_count + i);
-
-                /// Serialize record
-                uint8_t tmp[sizeof(record_t)];
-                memcpy(tmp, &hi_temp_buffer[i], size_record);
-
-                bool ok = Flash_PageProgram(address, tmp, size_record);
-                if (!ok)
-                {
+            /// Append staged and buffered records to the flash log as one batch (begin/end marker in EEPROM)
+            bool ok = flash_commit_records(hi_temp_buffer_base, HI_TEMP_RECORD_FLAGS, hi_temp_buffer, hi_temp_buffer_index);
 #if defined(DEBUG_MODE_HI_TEMP)
-                    DebugUVal("[HITMP]FlshWrtErr at i=", i, "");
+            if (!ok)
+                DebugLn("[HITMP]FlshWrtErr");
 #endif
-                    break;
-                }
-            }
-            Flash_Close();
-
-            /// For Debug: Dump data
-            Flash_Open();
-            for (uint16_t i = 0; i < hi_temp_buffer_index; i++)
-            {
-                record_t rec;
-                uint32_t address = flash_get_record_address(settings->flash_record_count + i);
-
-                uint8_t tmp[sizeof(record_t)];
-                Flash_ReadData(address, tmp, sizeof(record_t));
-                memcpy(&rec, tmp, sizeof(record_t));
-
-// Debug-Ausgabe
-#if defined(DEBUG_MODE_HI_TEMP)
-                // DebugUVal("[FLASH DUMP] Index     = ", i, "");
-                //  DebugHex16("[FLASH DUMP] Adress    = ", (uint16_t)address);
-                // DebugUVal("[FLASH DUMP] Timestamp = ", rec.timestamp, " (x5min)");
-                //  DebugFVal("[FLASH DUMP] Temp      = ", rec.temperature, "degC");
-                //  DebugUVal("[FLASH DUMP] Flags     = ", rec.flags, "");
-                //  DebugLn("--------------------------------------------------");
-#endif
-            }
-            Flash_Close();
-            ////////////////////////////// Debug Dump end
 #if defined(DEBUG_MODE_HI_TEMP)
             DebugLn("[HITMP]RAM>ext.fl");
-#endif
-            settings->flash_record_count += hi_temp_buffer_index;
-            settings_save();
-            settings_load();
-            settings = settings_get();
-#if defined(DEBUG_MODE_HI_TEMP)
-            DebugUVal("[HITMP]UpdFlRecCnt=", settings->flash_record_count, "");
+            DebugULong("[HITMP]FlRecCnt=", flash_get_count(), "");
 #endif
             state_transition(MODE_OPERATIONAL);
             return;
@@ -4,7 +4,9 @@
 #include "types.h"
 #include "modes/mode_operational.h"
 #include "modules/settings.h"
+#include "modules/storage.h"
 #include "modules/rtc.h"
+#include "modules/uplink.h"
 #include "periphery/tmp126.h"
 #include "periphery/mcp7940n.h"
 #include "periphery/flash.h"
@@ -39,10 +41,14 @@ typedef struct
     uint8_t fixed_alarm_s;        // fixed alarm only
     alarm_type_t alarm_type;      /// 0 = periodic, 1 = fixed-time
     uint8_t alarm_interval_5_min; // only periodic alarms, in 5min steps
+    bool slotted;                 // only periodic alarms: offset by the node's send slot
 } alarm_t;
 
 volatile bool mode_operational_rtc_alert_triggered = FALSE;
 
+/// FALSE nach einem Funk-Wecken im Sendeslot ohne fälligen Messzeitpunkt: kein zusätzlicher Datensatz
+static bool mode_operational_meas_due = TRUE;
+
 static void rtc_dump_time_if_debug(const char *tag)
 {
 #if defined(DEBUG_MODE_OPERATIONAL)
@@ -63,6 +69,22 @@ static void rtc_get_hms(uint8_t *h, uint8_t *m, uint8_t *s)
     MCP7940N_Close();
 }
 
+// Versatz des Sendeslots im Intervall: vom Gateway zugewiesen, sonst aus der Geräte-ID
+static uint32_t radio_slot_offset_sec(uint32_t interval_sec)
+{
+    uint16_t slots = (uint16_t)(interval_sec / RADIO_SLOT_SEC);
+    uint16_t slot;
+
+    if (slots <= 1)
+        return 0;
+
+    if (uplink_assigned_slot())
+        slot = uplink_assigned_slot() - 1;
+    else
+        slot = ((uint16_t)DEVICE_ID_MSB << 8) | DEVICE_ID_LSB; // fortlaufende IDs -> benachbarte Slots
+    return (uint32_t)(slot % slots) * RADIO_SLOT_SEC;
+}
+
 // Hilfsfunktion: nächste absolute Sekunde berechnen
 static uint32_t calc_next_alarm_sec(const alarm_t *alarm, uint32_t now_sec)
 {
@@ -91,8 +113,9 @@ static uint32_t calc_next_alarm_sec(const alarm_t *alarm, uint32_t now_sec)
         DebugULong("DBG: Shrt time to nxt al to ", dbg, "s");
         interval_sec = dbg;
 #endif
+        uint32_t offset_sec = alarm->slotted ? radio_slot_offset_sec(interval_sec) : 0;
         uint32_t next_abs =
-            ((now_sec / interval_sec) + 1UL) * interval_sec;
+            ((now_sec + interval_sec - offset_sec) / interval_sec) * interval_sec + offset_sec;
 
         if (next_abs >= SECONDS_PER_DAY) /* über Mitternacht */
             next_abs -= SECONDS_PER_DAY;
@@ -105,7 +128,7 @@ static uint32_t calc_next_alarm_sec(const alarm_t *alarm, uint32_t now_sec)
 void calculate_next_alarm(
     uint8_t curr_h, uint8_t curr_m, uint8_t curr_s,
     uint8_t *next_h, uint8_t *next_m, uint8_t *next_s,
-    next_alarm_type_t *next_alarm_type, alarm_t *radio_alarm, alarm_t *measure_temp_alarm)
+    next_alarm_type_t *next_alarm_type, bool *meas_due, alarm_t *radio_alarm, alarm_t *measure_temp_alarm)
 {
     // Zeit in Sekunden seit Mitternacht
     uint32_t now_sec = curr_h * 3600UL + curr_m * 60UL + curr_s;
@@ -128,6 +151,7 @@ void calculate_next_alarm(
         // Radio sowieso früher: Radio gewinnt
         chosen = radio_sec;
         *next_alarm_type = NEXT_ALARM_RADIO;
+        *meas_due = (radio_sec == temp_sec); // sonst folgt die Messung zu ihrer eigenen Zeit
         // DebugLn("Rd mch earl-Rd wins");
     }
 #if defined(DEBUG_CONFIGURATION)
@@ -139,6 +163,7 @@ void calculate_next_alarm(
         // Radio kommt knapp später: trotzdem Radio bevorzugen
         chosen = radio_sec;
         *next_alarm_type = NEXT_ALARM_RADIO;
+        *meas_due = TRUE; // Messung wird mit dem Funk-Wecken nachgeholt
         // DebugLn("Rd close l8t-Rd wins");
     }
     else
@@ -146,6 +171,7 @@ void calculate_next_alarm(
         // Temperatur deutlich früher: Temperatur gewinnt
         chosen = temp_sec;
         *next_alarm_type = NEXT_ALARM_TEMP;
+        *meas_due = TRUE;
         //  DebugLn("Tm mch earl-Tm wins");
     }
 
@@ -193,6 +219,7 @@ void mode_operational_run(void)
     radio_alarm.fixed_alarm_h = settings->send_fixed_hour;
     radio_alarm.fixed_alarm_m = settings->send_fixed_minute;
     radio_alarm.fixed_alarm_s = 0;
+    radio_alarm.slotted = TRUE;
 
     ///////////// Setting alarm config for temperature measurement
     measure_temp_alarm.alarm_type = (settings->meas_mode == 0) ? ALARM_TYPE_PERIODIC : ALARM_TYPE_FIXED_TIME;
@@ -200,6 +227,7 @@ void mode_operational_run(void)
     measure_temp_alarm.fixed_alarm_h = settings->meas_fixed_hour;
     measure_temp_alarm.fixed_alarm_m = settings->meas_fixed_minute;
     measure_temp_alarm.fixed_alarm_s = 0;
+    measure_temp_alarm.slotted = FALSE;
 
     ///////////// Debug RTC alarm status
     //  MCP7940N_Open();
@@ -211,12 +239,23 @@ void mode_operational_run(void)
     GPIO_Init(RTC_WAKE_PORT, RTC_WAKE_PIN, GPIO_MODE_IN_FL_IT);
     EXTI_SetExtIntSensitivity(RTC_EXTI_PORT, EXTI_SENSITIVITY_FALL_ONLY);
 
+    ///////////// Radio wake in the send slot, off the measurement grid: no extra record
+    if (!mode_operational_meas_due)
+    {
+        mode_operational_meas_due = TRUE;
+#if defined(DEBUG_MODE_OPERATIONAL)
+        DebugLn("[MDOP]No meas due");
+#endif
+        goto schedule;
+    }
+
     ///////////// Measure temperature
     TMP126_OpenForMeasurement();
     float temp_c = TMP126_ReadTemperatureCelsius();
     TMP126_CloseForMeasurement();
 
-    if (temp_c < -100.0f || temp_c > 200.0f)
+    temp_q4_t temp = temp_q4_from_c(temp_c); // ab hier nur noch Ganzzahl (1/16 °C)
+    if (temp < TEMP_Q4(TEMP_C_MIN) || temp > TEMP_Q4(TEMP_C_MAX))
     {
 #if defined(DEBUG_MODE_OPERATIONAL)
         DebugLn("[MDOP]tmp meas err");
@@ -224,7 +263,7 @@ void mode_operational_run(void)
         return;
     }
 #if defined(DEBUG_MODE_OPERATIONAL)
-    DebugFVal("[MDOP]Meas tmp:", temp_c, "");
+    DebugFVal("[MDOP]Meas tmp:", TEMP_Q4_TO_C(temp), "");
 #endif
 
     ///////////// Get timestamp from RTC
@@ -235,19 +274,11 @@ void mode_operational_run(void)
     ///////////// Create data record
     record_t rec;
     rec.timestamp = ts;
-    rec.temperature = temp_c;
+    rec.temperature = temp;
     rec.flags = FLAG_NONE;
 
-    ///////////// Prepare data write to external flash
-    settings = settings_get();
-    uint32_t address = flash_get_record_address(settings->flash_record_count);
-    uint8_t tmp[sizeof(record_t)];
-    memcpy(tmp, &rec, sizeof(record_t));
-
-    ///////////// Write into external flash
-    Flash_Open();
-    bool ok = Flash_PageProgram(address, tmp, sizeof(record_t));
-    Flash_Close();
+    ///////////// Append to flash log (packed record, write position is recovered from flash at boot)
+    bool ok = flash_write_record(&rec);
 #if defined(DEBUG_MODE_OPERATIONAL)
     if (!ok)
     {
@@ -257,17 +288,12 @@ void mode_operational_run(void)
     {
         DebugLn("[MDOP]Rec>flsh ok");
     }
-#endif
-
-    ///////////// Increment flash counter in settings (EEPROM)
-    settings->flash_record_count++;
-    settings_save();
-    settings_load(); // optional, wenn Konsistenz direkt benötigt
-#if defined(DEBUG_MODE_OPERATIONAL)
-    DebugUVal("[MDOP]Upd.rec_cnt=", settings->flash_record_count, ".");
+    DebugULong("[MDOP]rec_cnt=", flash_get_count(), ".");
 #endif
     ///////////// Determine next alarm type and time
+schedule:;
     uint8_t curr_h, curr_m, curr_s;
+    bool meas_due;
 sleep_again:    
     MCP7940N_Open();
     MCP7940N_GetTime(&curr_h, &curr_m, &curr_s);
@@ -280,7 +306,7 @@ sleep_again:
     next_alarm_type_t alarm_typ;
     // DebugUVal("RdTy:", radio_alarm.alarm_type, "");
     // DebugUVal("TmTy:", measure_temp_alarm.alarm_type, "");
-    calculate_next_alarm(curr_h, curr_m, curr_s, &next_h, &next_m, &next_s, &alarm_typ, &radio_alarm, &measure_temp_alarm);
+    calculate_next_alarm(curr_h, curr_m, curr_s, &next_h, &next_m, &next_s, &alarm_typ, &meas_due, &radio_alarm, &measure_temp_alarm);
     char buf[32];
     rtc_format_time(buf, next_h, next_m, next_s);
     Debug("setting al to :");
@@ -357,6 +383,7 @@ sleep_again:
 #if defined(DEBUG_MODE_OPERATIONAL)
         DebugLn("[MDOP]Int->Dt xfr");
 #endif
+        mode_operational_meas_due = meas_due; // gilt für den nächsten Durchlauf nach Übertragung bzw. Zeitfenster
 
         if (settings->send_time_window_active)
         {
@@ -376,6 +403,7 @@ sleep_again:
 #if defined(DEBUG_MODE_OPERATIONAL)
                 DebugLn("[MDOP]Out of tx wndw.stay in op");
 #endif
+                storage_maintenance(); // idle radio slot: erase ahead in the flash log
                 state_transition(MODE_OPERATIONAL);
                 return;
             }
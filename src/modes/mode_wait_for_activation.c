@@ -14,6 +14,7 @@
 #include "config/config.h"
 #include "app/state_machine.h"
 #include "modules/packet_handler.h"
+#include "modules/uplink.h"
 #include "periphery/hardware_resources.h"
 
 
@@ -41,7 +42,11 @@ void mode_wait_for_activation_run(void)
         //////////// Init retry counter, ack & cmd_announce flags
         uint8_t retry_count = 0;
         bool ack_received = FALSE;
+#if PING_ACK_INLINE_RTC
+        uplink_rtc_t rtc;
+#else
         bool cmd_announced = FALSE;
+#endif
 
         //////////// Send ping & wait-for-ack loop
         float temp;
@@ -53,6 +58,29 @@ void mode_wait_for_activation_run(void)
         {
             //////// Send ping
             RFM69_open(settings_get()->offset_hz, temp);
+#if PING_ACK_INLINE_RTC
+            uplink_send_ping(UPLINK_PING_ACTIVATION, 0);
+
+            //////// Check for ack carrying the time (the next ping confirms it)
+            ack_received = uplink_wait_ping_ack(WAIT_FOR_ACT_ACK_TIMEOUT, &rtc);
+            if (ack_received)
+            {
+#if defined(DEBUG_MODE_WAIT_FOR_ACTIVATION)
+                DebugLn("[RCVD]AckByGtwy");
+#endif
+                if (rtc.year == 0 || rtc.year > 2040)
+                    DebugLn("[FAIL]InvldCmd");
+                else
+                {
+                    rtc_set_date_time(rtc.year, rtc.month, rtc.day, rtc.hour, rtc.minute, rtc.second);
+                    activation_successful = TRUE;
+                    DebugLn("=ActCompl=");
+                    state_transition(MODE_PRE_HIGH_TEMP);
+                    RFM69_close();
+                    return;
+                }
+            }
+#else
             send_uplink_ping_for_activation(DEVICE_ID_MSB, DEVICE_ID_LSB);
 
             //////// Check for ack
@@ -138,6 +166,7 @@ void mode_wait_for_activation_run(void)
                     }
                 }
             }
+#endif
             RFM69_close();
             retry_count++;
             delay(DELAY_BEFORE_RETRY); /// Delay between pings in one try
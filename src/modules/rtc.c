@@ -87,6 +87,15 @@ timestamp_t rtc_get_timestamp(void)
     return ts_5min;
 }
 
+void rtc_set_date_time(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second)
+{
+    MCP7940N_Open();
+    MCP7940N_SetTime(hour, minute, second);
+    delay(1);
+    MCP7940N_SetDate(1, day, month, (uint8_t)(year - 2000));
+    MCP7940N_Close();
+}
+
 void rtc_set_alarm_in_minutes(rtc_alarm_t alarm, uint16_t delta_min)
 {
     uint8_t h, m, s;
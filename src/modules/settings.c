@@ -7,16 +7,44 @@
 #include "utility/debug.h"
 #include "utility/delay.h"
 
-#define SETTINGS_ADDR 0x30 // Startadresse im EEPROM
-#define SETTINGS_CRC_ADDR (SETTINGS_ADDR + sizeof(settings_t))
+#define SETTINGS_ADDR 0x30 // bisheriger fester Platz, nur noch gelesen (settings_load)
+#define SETTINGS_CRC_ADDR (SETTINGS_ADDR + sizeof(settings_v1_t))
 
 #define MODE_ADDR 0x20
 #define MODE_CRC_ADDR (MODE_ADDR + sizeof(mode_t))
 
+// Layout des festen Platzes (ohne Versionsbyte, Schwelle als float), nur für die Migration
+typedef struct
+{
+    uint8_t high_temp_measurement_interval_5min;
+    uint8_t transfer_mode;
+    uint8_t flags;
+    uint8_t flash_record_count;
+    uint8_t send_mode;
+    uint8_t send_interval_5min;
+    uint8_t send_fixed_hour;
+    uint8_t send_fixed_minute;
+    uint8_t send_time_window_active;
+    uint8_t send_time_window_from_hour;
+    uint8_t send_time_window_until_hour;
+    uint8_t meas_mode;
+    uint8_t meas_interval_5min;
+    uint8_t meas_fixed_hour;
+    uint8_t meas_fixed_minute;
+    float cool_down_threshold;
+    uint8_t device_id_msb;
+    uint8_t device_id_lsb;
+    int32_t offset_hz;
+} settings_v1_t;
+
 static settings_t current_settings;
+static settings_t saved_settings; // zuletzt geladenes bzw. gespeichertes Abbild
+static bool saved_valid = FALSE;  // saved_settings entspricht dem EEPROM
+static eeprom_journal_t settings_journal = EEPROM_JOURNAL(EEPROM_ADDR_JOURNAL_SETTINGS, sizeof(settings_t), EEPROM_JOURNAL_SETTINGS_SLOTS);
+EEPROM_JOURNAL_ASSERT(settings, EEPROM_ADDR_JOURNAL_SETTINGS, sizeof(settings_t), EEPROM_JOURNAL_SETTINGS_SLOTS, EEPROM_ADDR_JOURNAL_MODE);
 
-// CRC8 (einfach, z. B. XOR über alle Bytes)
-static uint8_t calc_crc8(const uint8_t *data, uint8_t len)
+// XOR-Prüfsumme des festen Platzes vor dem Journal, nur noch für die Migration lesbar
+static uint8_t calc_xor_checksum(const uint8_t *data, uint8_t len)
 {
     uint8_t crc = 0;
     for (uint8_t i = 0; i < len; ++i)
@@ -31,10 +59,11 @@ settings_t *settings_get(void)
 
 void settings_set_default(void)
 {
+    current_settings.version = SETTINGS_VERSION;
     current_settings.high_temp_measurement_interval_5min = DEFAULT_HI_TMP_MEAS_INTERVAL_5MIN; ///< Intervall im HIGH_TEMPERATURE-Modus
-    current_settings.transfer_mode = 0;                                                       ///< 0 = alle Daten, 1 = nur neue Datensätze
+    current_settings.transfer_mode = DEFAULT_TRANSFER_MODE;                                   ///< 0 = alle Daten, 1 = nur neue Datensätze
     current_settings.flags = 0x00;                                                            ///< z. B. Bit 0 = Flash initialized
-    current_settings.flash_record_count = 0;                                                  ///< Anzahl Datensätze im externen Flash
+    current_settings.transfer_acked_upto = 0;                                                 ///< noch nichts vom Gateway bestätigt
     current_settings.send_mode = DEFAULT_SEND_MODE;                                           ///< 0 = periodisch, 1 = feste Uhrzeit
     current_settings.send_interval_5min = DEFAULT_SEND_INTERVAL_5MIN;                         ///< nur bei send_mode=0: Intervall (in 5-min Schritten)
     current_settings.send_fixed_hour = DEFAULT_SEND_FIXED_HOUR;                               ///< nur bei send_mode=1: Stunde (0–23)
@@ -46,25 +75,67 @@ void settings_set_default(void)
     current_settings.meas_interval_5min = DEFAULT_MEAS_INTERVAL_5MIN;                         ///< nur bei meas_mode=0: Intervall (in 5-min Schritten)
     current_settings.meas_fixed_hour = DEFAULT_MEAS_FIXED_HOUR;                               ///< nur bei meas_mode=1: Stunde (0–23)
     current_settings.meas_fixed_minute = DEFAULT_MEAS_FIXED_MINUTE;                           ///< nur bei meas_mode=1: Minute (0–59)
-    current_settings.cool_down_threshold = DEFAULT_COOL_DOWN_THRESHOLD;                       ///< Temperatur-Schwelle
+    current_settings.cool_down_threshold = TEMP_Q4(DEFAULT_COOL_DOWN_THRESHOLD);              ///< Temperatur-Schwelle
     current_settings.device_id_lsb = DEVICE_ID_LSB;                                           ///< Eindeutige ID
     current_settings.device_id_msb = DEVICE_ID_MSB;                                           ///< Eindeutige ID
     current_settings.offset_hz = DEVICE_OFFSET_HZ_23_DEG;                                     ///< Freq Offset @23deg
 }
-void settings_load(void)
+// Übernimmt Einstellungen vom festen Platz (Layout ohne Versionsbyte); die Schwelle
+// wird einmalig umgerechnet, flash_record_count war ungenutzt und wird zum Übertragungs-Cursor
+static void settings_migrate_fixed(const settings_v1_t *old)
 {
-    uint8_t raw[sizeof(settings_t)];
-    uint8_t crc_stored = 0;
+    current_settings.version = SETTINGS_VERSION;
+    current_settings.high_temp_measurement_interval_5min = old->high_temp_measurement_interval_5min;
+    current_settings.transfer_mode = DEFAULT_TRANSFER_MODE; // hatte bisher keine Wirkung
+    current_settings.flags = old->flags;
+    current_settings.transfer_acked_upto = 0;
+    current_settings.send_mode = old->send_mode;
+    current_settings.send_interval_5min = old->send_interval_5min;
+    current_settings.send_fixed_hour = old->send_fixed_hour;
+    current_settings.send_fixed_minute = old->send_fixed_minute;
+    current_settings.send_time_window_active = old->send_time_window_active;
+    current_settings.send_time_window_from_hour = old->send_time_window_from_hour;
+    current_settings.send_time_window_until_hour = old->send_time_window_until_hour;
+    current_settings.meas_mode = old->meas_mode;
+    current_settings.meas_interval_5min = old->meas_interval_5min;
+    current_settings.meas_fixed_hour = old->meas_fixed_hour;
+    current_settings.meas_fixed_minute = old->meas_fixed_minute;
+    current_settings.cool_down_threshold = temp_q4_from_c(old->cool_down_threshold);
+    current_settings.device_id_msb = old->device_id_msb;
+    current_settings.device_id_lsb = old->device_id_lsb;
+    current_settings.offset_hz = old->offset_hz;
+}
 
-    storage_read_eeprom(SETTINGS_ADDR, raw, sizeof(settings_t));
-    storage_read_eeprom(SETTINGS_CRC_ADDR, &crc_stored, 1);
+void settings_load(void)
+{
+    // Abbild im RAM ist bereits validiert: kein erneutes Lesen/Prüfen nötig
+    if (saved_valid)
+    {
+        memcpy(&current_settings, &saved_settings, sizeof(settings_t));
+        return;
+    }
 
-    uint8_t crc_calc = calc_crc8(raw, sizeof(settings_t));
+    bool valid = storage_journal_read(&settings_journal, (uint8_t *)&current_settings) &&
+                 current_settings.version == SETTINGS_VERSION;
+    bool migrated = FALSE;
 
-    if (crc_calc == crc_stored)
+    if (!valid)
     {
-        memcpy(&current_settings, raw, sizeof(settings_t));
+        // Noch kein Journal: Einstellungen vom festen Platz übernehmen
+        settings_v1_t v1;
+        uint8_t crc_stored = 0;
+        storage_read_eeprom(SETTINGS_ADDR, (uint8_t *)&v1, sizeof(settings_v1_t));
+        storage_read_eeprom(SETTINGS_CRC_ADDR, &crc_stored, 1);
+        valid = (calc_xor_checksum((const uint8_t *)&v1, sizeof(settings_v1_t)) == crc_stored);
+        if (valid)
+        {
+            settings_migrate_fixed(&v1);
+            migrated = TRUE;
+        }
+    }
 
+    if (valid)
+    {
         // Plausibilitätscheck für neue Felder
         if (current_settings.meas_mode > 1 ||
             current_settings.send_mode > 1 ||
@@ -79,6 +150,16 @@ void settings_load(void)
             settings_set_default();
             settings_save();
         }
+        else if (migrated)
+        {
+            storage_journal_clear(&settings_journal); // keine Reste älterer Einträge neben dem ersten
+            settings_save();
+        }
+        else
+        {
+            memcpy(&saved_settings, &current_settings, sizeof(settings_t));
+            saved_valid = TRUE;
+        }
     }
     else
     {
@@ -87,16 +168,23 @@ void settings_load(void)
     }
 }
 
-void settings_save(void)
+/// Ungespeicherte Änderungen seit dem letzten Laden/Speichern?
+static bool settings_dirty(void)
 {
-    uint8_t raw[sizeof(settings_t)];
-    memcpy(raw, &current_settings, sizeof(settings_t));
+    return !saved_valid || memcmp(&current_settings, &saved_settings, sizeof(settings_t)) != 0;
+}
 
-    uint8_t crc = calc_crc8(raw, sizeof(settings_t));
+void settings_save(void)
+{
+    if (!saved_valid)
+        saved_valid = storage_journal_read(&settings_journal, (uint8_t *)&saved_settings);
 
-    // EEPROM: zuerst die eigentlichen Daten speichern
-    storage_write_eeprom(SETTINGS_ADDR, raw, sizeof(settings_t));
+    // Nur schreiben, wenn sich seit dem letzten Laden/Speichern etwas geändert hat
+    if (!settings_dirty())
+        return;
 
-    // danach die CRC speichern
-    storage_write_eeprom(SETTINGS_CRC_ADDR, &crc, 1);
+    // Neuer Eintrag im nächsten Journal-Slot, der bisherige bleibt bis zum Abschluss gültig
+    storage_journal_write(&settings_journal, (const uint8_t *)&current_settings);
+    memcpy(&saved_settings, &current_settings, sizeof(settings_t));
+    saved_valid = TRUE;
 }
@@ -1,47 +1,69 @@
 #include "modules/storage.h"
 #include "modules/settings.h"
+#include "config/config.h"
 // #include "modules/storage_internal.h"
 #include "types.h"
 #include "periphery/flash.h"
 #include "utility/debug.h"
 #include "utility/delay.h"
+#include "utility/crc8.h"
 #include "stm8s_flash.h"
 #include <string.h>
 #include "periphery/uart.h"
 
-#define EEPROM_ADDR_MODE 0x10
+#define EEPROM_ADDR_MODE 0x10 // bisheriger fester Platz, nur noch gelesen (load_persisted_mode)
 #define EEPROM_ADDR_DEVICE_ID 0x20
 
 #define DEVICE_ID_MAGIC 0xA5
 #define DEVICE_ID_LENGTH 4
 #define DEVICE_ID_TOTAL_SIZE (1 + DEVICE_ID_LENGTH)
 
-#define FLASH_ADDR_BASE 0x000100UL
+#define FLASH_ADDR_BASE 0x001000UL // Sektor 0: Zwischenspeicher (Hochtemperatur), das Log beginnt sektorbündig dahinter
 #define RECORD_SIZE_BYTES 5
-#define MAX_RECORDS 2048
 
-static uint32_t write_ptr = 0;
+//////// Log im externen Flash: Seitenaufbau
+#define FLASH_SIZE_BYTES 0x080000UL // AT25SF041: 4 Mbit
+#define FLASH_PAGE_SIZE_BYTES 256
+#define FLASH_SECTOR_SIZE_BYTES 0x1000UL // kleinste löschbare Einheit
+#define FLASH_LOG_SECTORS ((uint8_t)((FLASH_SIZE_BYTES - FLASH_ADDR_BASE) / FLASH_SECTOR_SIZE_BYTES))
+#define LOG_PAGES_PER_SECTOR ((uint16_t)(FLASH_SECTOR_SIZE_BYTES / FLASH_PAGE_SIZE_BYTES))
+#define FLASH_LOG_PAGES ((uint16_t)(FLASH_LOG_SECTORS * LOG_PAGES_PER_SECTOR))
+#define LOG_ERASE_AHEAD_SECTORS 2 ///< gelöschte Sektoren, die storage_maintenance() vor dem Schreibkopf bereithält
+
+#define LOG_PAGE_MAGIC 0x5A
+#define LOG_PAGE_HEADER_SIZE 10 // Magic (1) + Format (1) + Sequenznummer (4) + CRC-8 (1) + Sitzungsmarken (2) + Übertragen (1)
+#define LOG_PAGE_CRC_OFFSET 6    ///< CRC-8 über die Bytes davor
+#define LOG_PAGE_OPEN_OFFSET 7   ///< je Puffer-Sitzung ein gelöschtes Bit: geöffnet
+#define LOG_PAGE_COMMIT_OFFSET 8 ///< je Puffer-Sitzung ein gelöschtes Bit: programmiert
+#define LOG_PAGE_ACK_OFFSET 9    ///< 0x00: alle Datensätze des Sektors übertragen (erste gültige Seite eines Sektors)
+#define LOG_SLOT_SIZE RECORD_SIZE_BYTES
+
+#define LOG_FORMAT_PACKED5 0x01 ///< 5-Byte-Datensätze (entry_pack)
+#define LOG_FORMAT_DELTA 0x02   ///< Anker + bitgepackte Differenzen (log_delta_encode)
+#define LOG_SLOTS_PER_PAGE ((FLASH_PAGE_SIZE_BYTES - LOG_PAGE_HEADER_SIZE) / LOG_SLOT_SIZE)
+
+#define LOG_FORMAT_WRITE LOG_FORMAT_DELTA ///< Format für neu angelegte Seiten
+
+static uint16_t log_head_page = 0;                   ///< Seite, in die der nächste Datensatz geschrieben wird
+static uint16_t log_head_fill = 0;                   ///< Datensätze in log_head_page
+static uint32_t log_head_seq = 0;                    ///< Sequenznummer (= Nummer des ersten Datensatzes) von log_head_page
+static uint8_t log_head_format = LOG_FORMAT_WRITE;   ///< Format von log_head_page
+static uint8_t log_tail_sector = 0;                  ///< ältester belegter Sektor
+static uint32_t log_tail_seq = 0;                    ///< Nummer des ältesten noch gespeicherten Datensatzes
+static uint8_t log_acked_sectors = 0;                ///< Sektoren ab log_tail_sector, deren Datensätze übertragen sind
+static uint8_t log_erased_sectors = 0;               ///< gelöschte Sektoren hinter dem Sektor von log_head_page
 
 //////// Helper Functions
 
 static uint8_t calc_crc8(uint8_t value)
 {
-    uint8_t crc = 0;
-    crc ^= value;
-    for (uint8_t i = 0; i < 8; ++i)
-        crc = (crc & 0x80) ? (crc << 1) ^ 0x1D : (crc << 1);
-    return crc;
+    return crc8_update(0, &value, 1);
 }
 
 static uint8_t crc4_timestamp(uint32_t ts_5min)
 {
-    uint8_t crc = 0;
-    crc ^= (ts_5min >> 0) & 0xFF;
-    crc ^= (ts_5min >> 8) & 0xFF;
-    crc ^= (ts_5min >> 16) & 0x0F;
-    for (uint8_t i = 0; i < 8; ++i)
-        crc = (crc & 0x80) ? (crc << 1) ^ 0x03 : (crc << 1);
-    return crc & 0x0F;
+    uint8_t folded = (uint8_t)(ts_5min >> 0) ^ (uint8_t)(ts_5min >> 8) ^ ((uint8_t)(ts_5min >> 16) & 0x0F);
+    return crc4_calc(folded);
 }
 
 //////// Internal Flash
@@ -82,7 +104,11 @@ void storage_write_eeprom(uint16_t address, const uint8_t *data, uint16_t len) /
 #endif
     }
 
-    for (uint16_t i = 0; i < len; ++i)
+    // Unveränderte Bytes werden übersprungen. Ausgerichtete 4-Byte-Gruppen mit
+    // mehr als einem geänderten Byte gehen im Wortmodus in einem
+    // Programmierzyklus, sonst byteweise. Der Blockmodus bräuchte Code im RAM.
+    uint16_t i = 0;
+    while (i < len)
     {
         uint32_t target = FLASH_DATA_START_PHYSICAL_ADDRESS + address + i;
         if (target > (FLASH_DATA_END_PHYSICAL_ADDRESS))
@@ -93,11 +119,33 @@ void storage_write_eeprom(uint16_t address, const uint8_t *data, uint16_t len) /
             break;
         }
 
-        FLASH_ProgramByte(target, data[i]);
+        if ((target & 3) == 0 && len - i >= 4)
+        {
+            uint8_t changed = 0;
+            for (uint8_t k = 0; k < 4; ++k)
+                if (*(uint8_t *)(target + k) != data[i + k])
+                    ++changed;
+
+            if (changed > 1)
+            {
+                FLASH_ProgramWord(target, ((uint32_t)data[i] << 24) | ((uint32_t)data[i + 1] << 16) |
+                                              ((uint32_t)data[i + 2] << 8) | data[i + 3]);
+                while (!(FLASH->IAPSR & FLASH_IAPSR_EOP))
+                    ;
+                i += 4;
+                continue;
+            }
+        }
 
-        // auf Abschluss warten
-        while (!(FLASH->IAPSR & FLASH_IAPSR_EOP))
-            ;
+        if (*(uint8_t *)target != data[i])
+        {
+            FLASH_ProgramByte(target, data[i]);
+
+            // auf Abschluss warten
+            while (!(FLASH->IAPSR & FLASH_IAPSR_EOP))
+                ;
+        }
+        ++i;
     }
 }
 
@@ -110,24 +158,130 @@ bool storage_read_eeprom(uint16_t address, uint8_t *data, uint16_t len) // inter
     return TRUE;
 }
 
+//////// EEPROM-Journal
+//
+// Ein Journal belegt slots aufeinanderfolgende Slots gleicher Größe:
+// Sequenznummer (1 Byte), Nutzdaten, ggf. Füllbytes, CRC-8 über Sequenznummer
+// und Nutzdaten (letztes Byte). Geschrieben wird immer in den Slot nach dem
+// neuesten gültigen, die Schreiblast verteilt sich so gleichmäßig auf alle
+// Slots. Bricht ein Schreibvorgang ab, ist nur der neue Slot ungültig und der
+// vorige Eintrag bleibt lesbar. Die CRC beginnt mit 0xFF, damit gelöschter
+// EEPROM (0x00) nie als gültiger Slot gilt.
+
+#define JOURNAL_CRC_INIT 0xFF
+
+static uint8_t journal_slot_buf[EEPROM_JOURNAL_SLOT_SIZE(EEPROM_JOURNAL_MAX_LEN)];
+
+static uint16_t journal_slot_address(const eeprom_journal_t *j, uint8_t slot)
+{
+    return j->address + (uint16_t)slot * EEPROM_JOURNAL_SLOT_SIZE(j->len);
+}
+
+/// Prüft einen Slot und liefert dessen Sequenznummer.
+static bool journal_slot_valid(const eeprom_journal_t *j, uint8_t slot, uint8_t *seq)
+{
+    uint16_t size = EEPROM_JOURNAL_SLOT_SIZE(j->len);
+
+    storage_read_eeprom(journal_slot_address(j, slot), journal_slot_buf, size);
+    *seq = journal_slot_buf[0];
+    return journal_slot_buf[size - 1] == crc8_update(JOURNAL_CRC_INIT, journal_slot_buf, j->len + 1);
+}
+
+/// Sucht den neuesten gültigen Slot (Sequenznummern mit Überlauf verglichen).
+static void journal_scan(eeprom_journal_t *j)
+{
+    uint8_t seq;
+
+    j->valid = FALSE;
+    j->head = j->slots - 1; // erster Eintrag landet in Slot 0
+    j->seq = 0xFF;
+    for (uint8_t slot = 0; slot < j->slots; ++slot)
+    {
+        if (!journal_slot_valid(j, slot, &seq))
+            continue;
+        if (!j->valid || (int8_t)(seq - j->seq) > 0)
+        {
+            j->head = slot;
+            j->seq = seq;
+            j->valid = TRUE;
+        }
+    }
+    j->scanned = TRUE;
+}
+
+bool storage_journal_read(eeprom_journal_t *j, uint8_t *data) // internal flash
+{
+    if (!j->scanned)
+        journal_scan(j);
+    if (!j->valid)
+        return FALSE;
+    return storage_read_eeprom(journal_slot_address(j, j->head) + 1, data, j->len);
+}
+
+void storage_journal_write(eeprom_journal_t *j, const uint8_t *data) // internal flash
+{
+    if (!j->scanned)
+        journal_scan(j);
+
+    uint8_t slot = (j->head + 1 >= j->slots) ? 0 : j->head + 1;
+    uint8_t seq = j->seq + 1;
+    uint16_t size = EEPROM_JOURNAL_SLOT_SIZE(j->len);
+
+    // Slot komplett aufbauen und in einem Zug schreiben (Wortmodus); die CRC
+    // liegt im letzten Byte und wird damit zuletzt programmiert
+    memset(journal_slot_buf, 0, size);
+    journal_slot_buf[0] = seq;
+    memcpy(&journal_slot_buf[1], data, j->len);
+    journal_slot_buf[size - 1] = crc8_update(JOURNAL_CRC_INIT, journal_slot_buf, j->len + 1);
+    storage_write_eeprom(journal_slot_address(j, slot), journal_slot_buf, size);
+
+    j->head = slot;
+    j->seq = seq;
+    j->valid = TRUE;
+}
+
+void storage_journal_clear(eeprom_journal_t *j) // internal flash
+{
+    uint16_t size = EEPROM_JOURNAL_SLOT_SIZE(j->len);
+
+    memset(journal_slot_buf, 0, size);
+    for (uint8_t slot = 0; slot < j->slots; ++slot)
+        storage_write_eeprom(journal_slot_address(j, slot), journal_slot_buf, size);
+
+    j->head = j->slots - 1; // erster Eintrag landet in Slot 0
+    j->seq = 0xFF;
+    j->valid = FALSE;
+    j->scanned = TRUE;
+}
+
+//////// Betriebsmodus
+
+static eeprom_journal_t mode_journal = EEPROM_JOURNAL(EEPROM_ADDR_JOURNAL_MODE, 1, EEPROM_JOURNAL_MODE_SLOTS);
+EEPROM_JOURNAL_ASSERT(mode, EEPROM_ADDR_JOURNAL_MODE, 1, EEPROM_JOURNAL_MODE_SLOTS, EEPROM_ADDR_JOURNAL_BATCH);
+
 void persist_current_mode(mode_t mode) // internal flash
 {
     // DebugUVal("[storage] Speichere Modus:", mode, "");
     uint8_t value = (uint8_t)mode;
-    uint8_t crc = calc_crc8(value);
-    storage_write_eeprom(EEPROM_ADDR_MODE, &value, 1);
-    storage_write_eeprom(EEPROM_ADDR_MODE + 1, &crc, 1);
+    storage_journal_write(&mode_journal, &value);
 }
 
 bool load_persisted_mode(mode_t *out_mode) // internal flash
 {
     uint8_t value, crc;
+    if (storage_journal_read(&mode_journal, &value))
+    {
+        *out_mode = (mode_t)value;
+        //  DebugUVal("[storage] Geladener Modus:", value, "");
+        return TRUE;
+    }
+
+    // Journal noch leer: Modus aus der bisherigen festen Adresse übernehmen
     storage_read_eeprom(EEPROM_ADDR_MODE, &value, 1);
     storage_read_eeprom(EEPROM_ADDR_MODE + 1, &crc, 1);
     if (calc_crc8(value) == crc)
     {
         *out_mode = (mode_t)value;
-        //  DebugUVal("[storage] Geladener Modus:", value, "");
         return TRUE;
     }
 #if defined(DEBUG_STORAGE_C)
@@ -177,104 +331,1542 @@ bool load_persisted_mode(mode_t *out_mode) // internal flash
 
 //////// External Flash
 
-bool flash_write_record(const record_t *rec) // external flash
+//////// Datensatz-Codec (5 Byte, Format LOG_FORMAT_PACKED5)
+//
+// Byte 0..1 : Zeitstempel Bit 0..15
+// Byte 2    : Zeitstempel Bit 16..19 (oben) | CRC4 über Zeitstempel (unten)
+// Byte 3    : Temperatur (T + 50 °C) * 16, Bit 4..11
+// Byte 4    : Temperatur Bit 0..3 (oben) | Flags (unten)
+
+#define RECORD_TS_MAX 0xFFFFEUL // 0xFFFFF ist für unbeschriebene Slots reserviert
+#define RECORD_TEMP_FIXED_MAX 0x0FFF
+#define RECORD_TEMP_Q4_OFFSET (50 * 16) // gespeichert wird (T + 50 °C) * 16
+
+/// Ganzzahlige Form eines Datensatzes, wie er im Flash kodiert wird
+typedef struct
 {
-    if (!rec)
-        return FALSE;
+    uint32_t ts;   ///< Zeitstempel (20 Bit)
+    uint16_t temp; ///< (T + 50 °C) * 16 (12 Bit)
+    uint8_t flags; ///< Flags (4 Bit)
+} log_entry_t;
 
-    if (!Flash_Open())
+/// Begrenzt eine Temperatur auf den speicherbaren Bereich (-50 .. +205,9 °C).
+static uint16_t entry_temp(temp_q4_t temp)
+{
+    if (temp < -RECORD_TEMP_Q4_OFFSET)
+        return 0;
+    if (temp > RECORD_TEMP_FIXED_MAX - RECORD_TEMP_Q4_OFFSET)
+        return RECORD_TEMP_FIXED_MAX;
+    return (uint16_t)(temp + RECORD_TEMP_Q4_OFFSET);
+}
+
+static void entry_from_record(const record_t *rec, log_entry_t *e)
+{
+    e->ts = rec->timestamp;
+    if (e->ts > RECORD_TS_MAX)
+        e->ts = RECORD_TS_MAX;
+
+    e->temp = entry_temp(rec->temperature);
+    e->flags = rec->flags & 0x0F;
+}
+
+static void entry_from_compact(timestamp_t base_ts, uint8_t flags, const record_compact_t *rec, log_entry_t *e)
+{
+    e->ts = base_ts + rec->ts_offset;
+    if (e->ts > RECORD_TS_MAX)
+        e->ts = RECORD_TS_MAX;
+
+    e->temp = entry_temp(rec->temp_q4);
+    e->flags = flags & 0x0F;
+}
+
+static void entry_to_record(const log_entry_t *e, record_t *out)
+{
+    out->timestamp = e->ts;
+    out->temperature = (temp_q4_t)e->temp - RECORD_TEMP_Q4_OFFSET;
+    out->flags = e->flags;
+}
+
+static void entry_pack(const log_entry_t *e, uint8_t *raw)
+{
+    uint8_t crc4 = crc4_timestamp(e->ts);
+    raw[0] = (e->ts >> 0) & 0xFF;
+    raw[1] = (e->ts >> 8) & 0xFF;
+    raw[2] = ((e->ts >> 16) & 0x0F) << 4 | (crc4 & 0x0F);
+    raw[3] = (e->temp >> 4) & 0xFF;
+    raw[4] = ((e->temp & 0x0F) << 4) | (e->flags & 0x0F);
+}
+
+static bool entry_unpack(const uint8_t *raw, log_entry_t *out)
+{
+    out->ts = ((uint32_t)(raw[2] >> 4) << 16) | ((uint16_t)raw[1] << 8) | raw[0];
+    out->temp = ((uint16_t)raw[3] << 4) | (raw[4] >> 4);
+    out->flags = raw[4] & 0x0F;
+
+    if ((crc4_timestamp(out->ts) & 0x0F) != (raw[2] & 0x0F))
     {
-        DebugLn("[Flash] Öffnen fehlgeschlagen");
+#if defined(DEBUG_STORAGE_C)
+        DebugLn("[flash] CRC error");
+#endif
         return FALSE;
     }
+    return TRUE;
+}
 
-    uint8_t raw[RECORD_SIZE_BYTES];
-    uint32_t ts = rec->timestamp;
-    uint8_t crc4 = crc4_timestamp(ts);
-    raw[0] = (ts >> 0) & 0xFF;
-    raw[1] = (ts >> 8) & 0xFF;
-    raw[2] = ((ts >> 16) & 0x0F) << 4 | (crc4 & 0x0F);
+//////// Block-Codec (Format LOG_FORMAT_DELTA)
+//
+// Nach dem Seitenkopf steht ein vollständiger 5-Byte-Datensatz als Anker,
+// danach ein Bitstrom (MSB zuerst) mit einem Eintrag je weiterem Datensatz:
+//
+// Zeitstempel, dd = (ts - ts_vorher) - (ts_vorher - ts_vorvorher):
+//   '0'               dd = 0 (Regelfall: festes Messintervall)
+//   '10'  + 4 Bit     dd = -8 .. 7
+//   '110' + 20 Bit    absoluter Zeitstempel
+//   '111'             Ende der Seite (unbeschriebener Flash)
+// Temperatur, dt = temp - temp_vorher:
+//   '0'  + 3 Bit      dt = -4 .. 3
+//   '10' + 6 Bit      dt = -32 .. 31
+//   '11' + 12 Bit     absoluter Wert
+// Flags:
+//   '0'               unverändert
+//   '1'  + 4 Bit      neuer Wert
+//
+// Ein typischer Eintrag belegt 6..10 Bit statt 40 Bit. Neue Einträge werden
+// nur angehängt; da unbeschriebene Bits 1 sind, darf das zuletzt teilweise
+// belegte Byte beim nächsten Eintrag erneut programmiert werden.
+//
+// Die letzten beiden Bytes der Seite enthalten eine CRC-8 über Anker und
+// Bitstrom und ihr Komplement. Sie werden programmiert, wenn die Seite voll
+// ist und abgeschlossen wird; solange beide 0xFF sind, ist die Seite offen.
+
+#define LOG_DELTA_DATA_OFFSET (LOG_PAGE_HEADER_SIZE + RECORD_SIZE_BYTES)
+#define LOG_DELTA_CRC_OFFSET (FLASH_PAGE_SIZE_BYTES - 2) ///< Daten-CRC und Komplement
+#define LOG_DELTA_BITS ((uint16_t)(LOG_DELTA_CRC_OFFSET - LOG_DELTA_DATA_OFFSET) * 8)
+
+/// Laufzustand des Block-Codecs (Schreiben und Lesen)
+typedef struct
+{
+    uint16_t bitpos;  ///< Position im Bitstrom der Seite
+    log_entry_t prev; ///< zuletzt kodierter Datensatz
+    int32_t prev_d;   ///< letzte Zeitstempel-Differenz
+} log_delta_t;
 
-    int16_t temp_fixed = (int16_t)((rec->temperature + 50.0f) * 16.0f);
-    raw[3] = (temp_fixed >> 4) & 0xFF;
-    raw[4] = ((temp_fixed & 0x0F) << 4) | (rec->flags & 0x0F);
+/// Schreibt nbits von value ab Bitposition pos. buf == NULL: nur Länge bestimmen.
+static void bits_put(uint8_t *buf, uint16_t pos, uint16_t value, uint8_t nbits)
+{
+    if (!buf)
+        return;
+    while (nbits--)
+    {
+        if (!((value >> nbits) & 1))
+            buf[pos >> 3] &= (uint8_t)~(0x80 >> (pos & 7));
+        pos++;
+    }
+}
 
-    DebugLn("[Flash] Schreibe Datensatz ins Flash");
-    DebugUVal("-> Timestamp", ts, "");
-    DebugIVal("-> Temp*16", temp_fixed, "");
-    DebugUVal("-> Flags", rec->flags, "");
+static uint16_t bits_get(const uint8_t *buf, uint16_t pos, uint8_t nbits)
+{
+    uint16_t value = 0;
+    while (nbits--)
+    {
+        value = (value << 1) | ((buf[pos >> 3] >> (7 - (pos & 7))) & 1);
+        pos++;
+    }
+    return value;
+}
 
-    bool ok = Flash_PageProgram(FLASH_ADDR_BASE + write_ptr, raw, RECORD_SIZE_BYTES);
+static int16_t sign_extend(uint16_t value, uint8_t nbits)
+{
+    if (value & (1U << (nbits - 1)))
+        return (int16_t)(value | (uint16_t)(0xFFFFU << nbits));
+    return (int16_t)value;
+}
 
-    Flash_Close();
+static void log_delta_start(log_delta_t *st, const log_entry_t *anchor)
+{
+    st->bitpos = 0;
+    st->prev = *anchor;
+    st->prev_d = 0;
+}
 
-    if (ok)
-        write_ptr += RECORD_SIZE_BYTES;
+/// Kodiert e ab Bitposition pos in buf (NULL: nur Länge bestimmen). Rückgabe: Anzahl Bits.
+static uint8_t log_delta_encode(const log_delta_t *st, const log_entry_t *e, uint8_t *buf, uint16_t pos)
+{
+    uint16_t start = pos;
+    int32_t d = (int32_t)e->ts - (int32_t)st->prev.ts;
+    int32_t dd = d - st->prev_d;
+
+    if (dd == 0)
+    {
+        bits_put(buf, pos, 0x0, 1);
+        pos += 1;
+    }
+    else if (dd >= -8 && dd <= 7)
+    {
+        bits_put(buf, pos, 0x2, 2);
+        bits_put(buf, pos + 2, (uint16_t)dd & 0x0F, 4);
+        pos += 6;
+    }
     else
-        DebugLn("[Flash] Schreiben fehlgeschlagen");
+    {
+        bits_put(buf, pos, 0x6, 3);
+        bits_put(buf, pos + 3, (uint16_t)(e->ts >> 16) & 0x0F, 4);
+        bits_put(buf, pos + 7, (uint16_t)e->ts, 16);
+        pos += 23;
+    }
 
-    return ok;
+    int16_t dt = (int16_t)e->temp - (int16_t)st->prev.temp;
+    if (dt >= -4 && dt <= 3)
+    {
+        bits_put(buf, pos, 0x0, 1);
+        bits_put(buf, pos + 1, (uint16_t)dt & 0x07, 3);
+        pos += 4;
+    }
+    else if (dt >= -32 && dt <= 31)
+    {
+        bits_put(buf, pos, 0x2, 2);
+        bits_put(buf, pos + 2, (uint16_t)dt & 0x3F, 6);
+        pos += 8;
+    }
+    else
+    {
+        bits_put(buf, pos, 0x3, 2);
+        bits_put(buf, pos + 2, e->temp, 12);
+        pos += 14;
+    }
+
+    if (e->flags == st->prev.flags)
+    {
+        bits_put(buf, pos, 0x0, 1);
+        pos += 1;
+    }
+    else
+    {
+        bits_put(buf, pos, 0x1, 1);
+        bits_put(buf, pos + 1, e->flags, 4);
+        pos += 5;
+    }
+
+    return (uint8_t)(pos - start);
 }
-/*
-bool flash_read_record(uint16_t index, record_t *out) // external flash
+
+static void log_delta_advance(log_delta_t *st, const log_entry_t *e, uint8_t nbits)
+{
+    st->prev_d = (int32_t)e->ts - (int32_t)st->prev.ts;
+    st->prev = *e;
+    st->bitpos += nbits;
+}
+
+/// Dekodiert den nächsten Eintrag aus dem Bitstrom data. FALSE am Seitenende.
+static bool log_delta_decode(log_delta_t *st, const uint8_t *data, log_entry_t *out)
 {
-    if (!out || index >= MAX_RECORDS)
+    uint16_t pos = st->bitpos;
+
+#define LOG_DELTA_NEED(n)                  \
+    if ((uint16_t)(pos + (n)) > LOG_DELTA_BITS) \
         return FALSE;
 
+    LOG_DELTA_NEED(3)
+    if (bits_get(data, pos, 1) == 0)
+    {
+        out->ts = st->prev.ts + st->prev_d;
+        pos += 1;
+    }
+    else if (bits_get(data, pos, 2) == 0x2)
+    {
+        LOG_DELTA_NEED(6)
+        out->ts = st->prev.ts + st->prev_d + sign_extend(bits_get(data, pos + 2, 4), 4);
+        pos += 6;
+    }
+    else if (bits_get(data, pos, 3) == 0x6)
+    {
+        LOG_DELTA_NEED(23)
+        out->ts = ((uint32_t)bits_get(data, pos + 3, 4) << 16) | bits_get(data, pos + 7, 16);
+        pos += 23;
+    }
+    else
+    {
+        return FALSE; // '111': unbeschrieben
+    }
+
+    LOG_DELTA_NEED(2)
+    if (bits_get(data, pos, 1) == 0)
+    {
+        LOG_DELTA_NEED(4)
+        out->temp = (uint16_t)((int16_t)st->prev.temp + sign_extend(bits_get(data, pos + 1, 3), 3));
+        pos += 4;
+    }
+    else if (bits_get(data, pos, 2) == 0x2)
+    {
+        LOG_DELTA_NEED(8)
+        out->temp = (uint16_t)((int16_t)st->prev.temp + sign_extend(bits_get(data, pos + 2, 6), 6));
+        pos += 8;
+    }
+    else
+    {
+        LOG_DELTA_NEED(14)
+        out->temp = bits_get(data, pos + 2, 12);
+        pos += 14;
+    }
+    out->temp &= RECORD_TEMP_FIXED_MAX;
+
+    LOG_DELTA_NEED(1)
+    if (bits_get(data, pos, 1) == 0)
+    {
+        out->flags = st->prev.flags;
+        pos += 1;
+    }
+    else
+    {
+        LOG_DELTA_NEED(5)
+        out->flags = (uint8_t)bits_get(data, pos + 1, 4);
+        pos += 5;
+    }
+#undef LOG_DELTA_NEED
+
+    log_delta_advance(st, out, (uint8_t)(pos - st->bitpos));
+    return TRUE;
+}
+
+//////// Log-Verwaltung (append-only)
+//
+// Jede Flash-Seite beginnt mit einem Kopf aus Magic, Formatkennung,
+// Sequenznummer, CRC-8 und zwei Markierungsbytes. Die Sequenznummer ist die
+// laufende Nummer des ersten Datensatzes der Seite, danach folgen die
+// Datensätze im Format der Seite. Unbeschriebener Flash liest sich als 0xFF.
+// Beim Start werden Schreibkopf und ältester Datensatz über die Seitenköpfe
+// bestimmt, ein Zähler im EEPROM ist dafür nicht mehr nötig.
+//
+// Ringpuffer: Das Log läuft sektorweise im Kreis über den Flash. Vor dem
+// Schreibkopf hält storage_maintenance() bis zu LOG_ERASE_AHEAD_SECTORS
+// gelöschte Sektoren bereit, damit beim Schreiben nie gelöscht werden muss.
+// Der älteste Sektor wird erst gelöscht, wenn flash_ack_records() alle seine
+// Datensätze als übertragen bestätigt hat (Markierung LOG_PAGE_ACK_OFFSET).
+// Ist kein gelöschter Sektor mehr frei, werden neue Datensätze abgewiesen.
+//
+// Schreibpuffer: Neue Datensätze werden zunächst nur in das RAM-Abbild der
+// Kopfseite (log_head_buf) kodiert und erst programmiert, wenn
+// FLASH_WRITE_CHUNK_BYTES zusammengekommen sind, die Seite voll ist oder
+// storage_flush() aufgerufen wird. Jede solche Puffer-Sitzung löscht beim
+// ersten gepufferten Datensatz ein Bit in LOG_PAGE_OPEN_OFFSET und nach dem
+// Programmieren das gleiche Bit in LOG_PAGE_COMMIT_OFFSET. Beide Bytes liegen
+// außerhalb der Kopf-CRC. Sind beim Start mehr Sitzungen geöffnet als
+// übernommen, sind gepufferte Datensätze durch Reset oder Brownout verloren
+// gegangen; der nächste Datensatz erhält dann RECORD_FLAG_DATA_LOST. Nach
+// acht Sitzungen einer Seite wird bis zum Seitenende direkt geschrieben.
+
+typedef struct
+{
+    uint8_t format; ///< Kodierung der Datensätze dieser Seite (LOG_FORMAT_...)
+    uint32_t seq;   ///< Laufende Nummer des ersten Datensatzes der Seite
+} log_page_header_t;
+
+/// Lesezustand für die Datensätze einer Seite
+typedef struct
+{
+    const uint8_t *page; ///< Seitenabbild (log_page_buf oder log_head_buf)
+    uint8_t format;
+    uint16_t index;    ///< Nummer des nächsten Datensatzes innerhalb der Seite
+    log_delta_t delta; ///< nur LOG_FORMAT_DELTA
+} log_page_reader_t;
+
+typedef enum
+{
+    LOG_READ_OK,
+    LOG_READ_CRC_ERR,
+    LOG_READ_END
+} log_read_result_t;
+
+/// Lesezustand über Seitengrenzen hinweg
+typedef struct
+{
+    uint32_t index;       ///< Nummer des nächsten Datensatzes
+    uint16_t page;        ///< Seite, aus der gerade gelesen wird
+    log_page_reader_t rd; ///< Position innerhalb der Seite
+} log_cursor_t;
+
+#define LOG_PAGE_NONE 0xFFFF
+
+static uint8_t log_page_buf[FLASH_PAGE_SIZE_BYTES]; ///< Lesepuffer für eine Seite
+static uint16_t log_page_buf_page = LOG_PAGE_NONE;  ///< Seite, deren Inhalt in log_page_buf steht
+static uint8_t log_head_buf[FLASH_PAGE_SIZE_BYTES]; ///< RAM-Abbild der Kopfseite inkl. gepufferter Datensätze
+static log_delta_t log_head_delta;                  ///< Codec-Zustand der Kopfseite (LOG_FORMAT_DELTA)
+static uint16_t log_head_flushed = 0;               ///< Bytes vor diesem Offset stehen bereits im Flash
+static uint8_t log_head_session = 0;                ///< Anzahl Puffer-Sitzungen der Kopfseite
+static bool log_head_pending = FALSE;               ///< Datensätze im RAM, die noch nicht programmiert sind
+static bool log_data_lost = FALSE;                  ///< verlorene Puffer-Sitzung beim Start erkannt
+static bool log_flash_open = FALSE;
+static uint16_t log_stage_count = 0; ///< Datensätze im Zwischenspeicher
+static uint8_t log_stage_crc = 0;    ///< laufende Stapel-CRC über den Zwischenspeicher
+static bool log_stage_blank = TRUE;  ///< Slot log_stage_count ist unbeschrieben
+static bool log_stage_open = FALSE;  ///< Übernahme ins Log begonnen, aber nicht abgeschlossen
+static uint32_t log_stage_first = 0; ///< Nummer des ersten übernommenen Datensatzes (log_stage_open)
+static bool log_block_open = FALSE;  ///< hält den Flash bis flash_block_close() geöffnet
+
+/// Öffnet den Flash bei Bedarf (nur für Zugriffe, die wirklich den Baustein brauchen).
+static bool log_flash_acquire(void)
+{
+    if (log_flash_open)
+        return TRUE;
     if (!Flash_Open())
     {
-        DebugLn("[flash] Open flash failed");
+        DebugLn("[Flash] Öffnen fehlgeschlagen");
         return FALSE;
     }
+    log_flash_open = TRUE;
+    return TRUE;
+}
 
-    uint8_t raw[RECORD_SIZE_BYTES];
-    uint32_t addr = FLASH_ADDR_BASE + index * RECORD_SIZE_BYTES;
+static void log_flash_release(void)
+{
+    if (!log_flash_open || log_block_open)
+        return;
+    Flash_Close();
+    log_flash_open = FALSE;
+}
+
+static uint32_t log_page_address(uint16_t page)
+{
+    return FLASH_ADDR_BASE + (uint32_t)page * FLASH_PAGE_SIZE_BYTES;
+}
 
-    uint16_t addr_lo = (uint16_t)(addr & 0xFFFF);         // Low-Word (untere 16 Bit)
-    uint16_t addr_hi = (uint16_t)((addr >> 16) & 0xFFFF); // High-Word (obere 16 Bit)
+static void log_build_header(uint8_t *hdr, uint8_t format, uint32_t seq)
+{
+    hdr[0] = LOG_PAGE_MAGIC;
+    hdr[1] = format;
+    hdr[2] = (uint8_t)(seq >> 24);
+    hdr[3] = (uint8_t)(seq >> 16);
+    hdr[4] = (uint8_t)(seq >> 8);
+    hdr[5] = (uint8_t)(seq >> 0);
+    hdr[LOG_PAGE_CRC_OFFSET] = crc8_update(0, hdr, LOG_PAGE_CRC_OFFSET);
+    hdr[LOG_PAGE_OPEN_OFFSET] = 0xFF;
+    hdr[LOG_PAGE_COMMIT_OFFSET] = 0xFF;
+    hdr[LOG_PAGE_ACK_OFFSET] = 0xFF;
+}
 
-    DebugUVal("Read Addr LOW ", addr_lo, "");
-    DebugUVal("Read Addr HIGH", addr_hi, "");
+static bool log_parse_header(const uint8_t *hdr, log_page_header_t *out)
+{
+    if (hdr[0] != LOG_PAGE_MAGIC || crc8_update(0, hdr, LOG_PAGE_CRC_OFFSET) != hdr[LOG_PAGE_CRC_OFFSET])
+        return FALSE;
 
-    //bool ok =
-     Flash_ReadData(addr, raw, RECORD_SIZE_BYTES);
+    out->format = hdr[1];
+    out->seq = ((uint32_t)hdr[2] << 24) | ((uint32_t)hdr[3] << 16) | ((uint32_t)hdr[4] << 8) | hdr[5];
+    return TRUE;
+}
 
-    Flash_Close();
+/// Liest den Seitenkopf. Flash muss geöffnet sein.
+static bool log_read_header(uint16_t page, log_page_header_t *out)
+{
+    uint8_t hdr[LOG_PAGE_HEADER_SIZE];
+    Flash_ReadData(log_page_address(page), hdr, LOG_PAGE_HEADER_SIZE);
+    return log_parse_header(hdr, out);
+}
 
-  //  if (!ok)
-  //  {
-   //     DebugLn("[flash] Read fail");
-//        // DebugUVal("[flash] Rad fail at index ", index, "");
-//        return FALSE;
- //   }
+/// Anzahl gelöschter Markierungsbits (werden von Bit 0 aufwärts gelöscht)
+static uint8_t log_count_marks(uint8_t map)
+{
+    uint8_t n = 0;
+    while (n < 8 && !(map & (1 << n)))
+        n++;
+    return n;
+}
 
-    uint32_t ts = ((uint32_t)(raw[2] >> 4) << 16) | ((uint16_t)raw[1] << 8) | raw[0];
-    uint8_t crc4 = raw[2] & 0x0F;
-    uint8_t expected_crc = crc4_timestamp(ts);
-    if ((expected_crc & 0x0F) != crc4)
+static bool log_slot_is_erased(const uint8_t *slot)
+{
+    for (uint8_t i = 0; i < LOG_SLOT_SIZE; ++i)
     {
-        DebugLn("[flash] CRC error");
-        // DebugUVal("[flash] CRC4 Fehler bei Index ", index, "");
-        return FALSE;
+        if (slot[i] != 0xFF)
+            return FALSE;
     }
+    return TRUE;
+}
+
+/// CRC-8 über Anker und Bitstrom einer Seite im Format LOG_FORMAT_DELTA
+static uint8_t log_page_crc(const uint8_t *page)
+{
+    return crc8_update(0, &page[LOG_PAGE_HEADER_SIZE], LOG_DELTA_CRC_OFFSET - LOG_PAGE_HEADER_SIZE);
+}
 
-    int16_t temp_fixed = ((int16_t)raw[3] << 4) | (raw[4] >> 4);
+/// Prüft die Daten-CRC einer abgeschlossenen Seite. Offene Seiten und Seiten
+/// ohne Daten-CRC (LOG_FORMAT_PACKED5, CRC4 je Datensatz) gelten als gültig.
+static bool log_page_crc_ok(const uint8_t *page, uint8_t format)
+{
+    const uint8_t *crc = &page[LOG_DELTA_CRC_OFFSET];
 
-    out->timestamp = ts;
-    out->temperature = ((float)temp_fixed / 16.0f) - 50.0f;
-    out->flags = raw[4] & 0x0F;
+    if (format != LOG_FORMAT_DELTA || (crc[0] == 0xFF && crc[1] == 0xFF))
+        return TRUE;
+    return crc[1] == (uint8_t)~crc[0] && crc[0] == log_page_crc(page);
+}
+
+/// Beginnt das Lesen einer Seite. FALSE, wenn die Daten-CRC nicht passt.
+static bool log_reader_start(log_page_reader_t *rd, const uint8_t *page, uint8_t format)
+{
+    rd->page = page;
+    rd->format = format;
+    rd->index = 0;
+    return log_page_crc_ok(page, format);
+}
 
-    //  DebugUVal("[flash] Gelesen: Timestamp", ts, "");
-    //   DebugIVal("          Temp", (int)(out->temperature * 100), " x0.01C");
-    ///  DebugUVal("          Flags", out->flags, "");
+/// Liefert den nächsten Datensatz der Seite.
+static log_read_result_t log_reader_next(log_page_reader_t *rd, log_entry_t *out)
+{
+    const uint8_t *raw;
+
+    switch (rd->format)
+    {
+    case LOG_FORMAT_PACKED5:
+        if (rd->index >= LOG_SLOTS_PER_PAGE)
+            return LOG_READ_END;
+        raw = &rd->page[LOG_PAGE_HEADER_SIZE + rd->index * LOG_SLOT_SIZE];
+        if (log_slot_is_erased(raw))
+            return LOG_READ_END;
+        rd->index++;
+        return entry_unpack(raw, out) ? LOG_READ_OK : LOG_READ_CRC_ERR;
+
+    case LOG_FORMAT_DELTA:
+        if (rd->index == 0)
+        {
+            raw = &rd->page[LOG_PAGE_HEADER_SIZE];
+            if (log_slot_is_erased(raw))
+                return LOG_READ_END;
+            bool ok = entry_unpack(raw, out);
+            log_delta_start(&rd->delta, out);
+            rd->index++;
+            return ok ? LOG_READ_OK : LOG_READ_CRC_ERR;
+        }
+        if (!log_delta_decode(&rd->delta, &rd->page[LOG_DELTA_DATA_OFFSET], out))
+            return LOG_READ_END;
+        rd->index++;
+        return LOG_READ_OK;
+
+    default:
+        return LOG_READ_END;
+    }
+}
 
+/// Springt im Leser zum Datensatz skip der Seite. Rückgabe FALSE, wenn die Seite vorher endet.
+static bool log_reader_skip(log_page_reader_t *rd, uint16_t skip)
+{
+    log_entry_t e;
+    if (rd->format == LOG_FORMAT_PACKED5)
+    {
+        rd->index = skip;
+        return TRUE;
+    }
+    while (rd->index < skip)
+    {
+        if (log_reader_next(rd, &e) == LOG_READ_END)
+            return FALSE;
+    }
     return TRUE;
-}*/
-/*
-uint16_t flash_get_count(void) // external flash
+}
+
+static bool log_is_blank(const uint8_t *data, uint16_t len)
 {
-    return (uint16_t)(write_ptr / RECORD_SIZE_BYTES);
-}*/
+    for (uint16_t i = 0; i < len; ++i)
+    {
+        if (data[i] != 0xFF)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/// Prüft, ob der Kopfbereich einer Seite unbeschrieben ist. Flash muss geöffnet sein.
+static bool log_page_is_blank(uint16_t page)
+{
+    uint8_t hdr[LOG_PAGE_HEADER_SIZE];
+    Flash_ReadData(log_page_address(page), hdr, LOG_PAGE_HEADER_SIZE);
+    return log_is_blank(hdr, LOG_PAGE_HEADER_SIZE);
+}
+
+static uint8_t log_sector_of(uint16_t page)
+{
+    return (uint8_t)(page / LOG_PAGES_PER_SECTOR);
+}
+
+static uint8_t log_sector_next(uint8_t sector)
+{
+    return (sector + 1 >= FLASH_LOG_SECTORS) ? 0 : sector + 1;
+}
+
+/// Sucht die erste Seite eines Sektors mit gültigem Kopf (angefangene Köpfe werden
+/// übersprungen). FALSE, wenn der Sektor keine Datensätze enthält. Flash muss geöffnet sein.
+static bool log_sector_first_page(uint8_t sector, uint16_t *page, log_page_header_t *hdr)
+{
+    uint8_t raw[LOG_PAGE_HEADER_SIZE];
+    uint16_t p = (uint16_t)sector * LOG_PAGES_PER_SECTOR;
+
+    for (uint8_t i = 0; i < LOG_PAGES_PER_SECTOR; ++i, ++p)
+    {
+        Flash_ReadData(log_page_address(p), raw, LOG_PAGE_HEADER_SIZE);
+        if (log_parse_header(raw, hdr))
+        {
+            *page = p;
+            return TRUE;
+        }
+        if (log_is_blank(raw, LOG_PAGE_HEADER_SIZE))
+            return FALSE;
+    }
+    return FALSE;
+}
+
+/// Nummer des ersten Datensatzes eines Sektors. Ohne programmierten Kopf (nur beim
+/// Kopfsektor möglich) gilt log_head_seq. Flash muss geöffnet sein.
+static uint32_t log_sector_seq(uint8_t sector)
+{
+    uint16_t page;
+    log_page_header_t hdr;
+    return log_sector_first_page(sector, &page, &hdr) ? hdr.seq : log_head_seq;
+}
+
+/// Prüft die Markierung "übertragen" eines Sektors. Flash muss geöffnet sein.
+static bool log_sector_is_acked(uint8_t sector)
+{
+    uint16_t page;
+    log_page_header_t hdr;
+    uint8_t mark;
+
+    if (!log_sector_first_page(sector, &page, &hdr))
+        return FALSE;
+    Flash_ReadData(log_page_address(page) + LOG_PAGE_ACK_OFFSET, &mark, 1);
+    return mark == 0x00;
+}
+
+/// Prüft, ob ein Sektor vollständig gelöscht ist (nutzt log_page_buf). Flash muss geöffnet sein.
+static bool log_sector_is_blank(uint8_t sector)
+{
+    uint16_t p = (uint16_t)sector * LOG_PAGES_PER_SECTOR;
+
+    log_page_buf_page = LOG_PAGE_NONE;
+    for (uint8_t i = 0; i < LOG_PAGES_PER_SECTOR; ++i, ++p)
+    {
+        Flash_ReadData(log_page_address(p), log_page_buf, FLASH_PAGE_SIZE_BYTES);
+        if (!log_is_blank(log_page_buf, FLASH_PAGE_SIZE_BYTES))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/// Löscht einen Sektor, sofern er nicht schon leer ist. Flash muss geöffnet sein.
+static bool log_sector_erase(uint8_t sector)
+{
+    if (log_sector_is_blank(sector))
+        return TRUE;
+#if defined(DEBUG_STORAGE_C)
+    DebugUVal("[storage] Lösche Sektor ", sector, "");
+#endif
+    log_page_buf_page = LOG_PAGE_NONE;
+    return Flash_SectorErase(log_page_address((uint16_t)sector * LOG_PAGES_PER_SECTOR));
+}
+
+/// Sucht ab Position *pos (relativ zur Seite first) bis last die nächste Seite mit
+/// gültigem Kopf; angefangene Köpfe nach Stromausfall werden übersprungen. Flash muss geöffnet sein.
+static bool log_probe_header(uint16_t first, uint16_t *pos, uint16_t last, log_page_header_t *hdr)
+{
+    for (; *pos <= last; ++*pos)
+    {
+        if (log_read_header((first + *pos) % FLASH_LOG_PAGES, hdr))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/// Sucht die Seite, die den Datensatz mit der laufenden Nummer index enthält.
+static bool log_find_page(uint32_t index, uint16_t *page)
+{
+    log_page_header_t hdr;
+    uint16_t first = (uint16_t)log_tail_sector * LOG_PAGES_PER_SECTOR;
+    uint16_t lo = 0;
+    uint16_t hi;
+    uint16_t last;
+
+    if (index < log_tail_seq || index >= log_head_seq + log_head_fill)
+        return FALSE;
+
+    if (index >= log_head_seq)
+    {
+        *page = log_head_page; // liegt im RAM-Abbild
+        return TRUE;
+    }
+
+    if (!log_flash_acquire())
+        return FALSE;
+
+    // letzte Seite zwischen ältestem Sektor und Kopfseite mit seq <= index
+    last = hi = (uint16_t)((log_head_page + FLASH_LOG_PAGES - first) % FLASH_LOG_PAGES) - 1;
+    while (lo < hi)
+    {
+        uint16_t mid = (uint16_t)((lo + hi + 1) / 2);
+        uint16_t probe = mid; // unlesbarer Kopf: mit der nächsten gültigen Seite vergleichen
+        if (log_probe_header(first, &probe, hi, &hdr) && hdr.seq <= index)
+            lo = probe;
+        else
+            hi = mid - 1;
+    }
+    if (!log_probe_header(first, &lo, last, &hdr)) // nur möglich, wenn schon die erste Seite unlesbar ist
+        return FALSE;
+    *page = (first + lo) % FLASH_LOG_PAGES;
+    return TRUE;
+}
+
+/// Liefert das Abbild einer Seite: die Kopfseite aus dem RAM, alle anderen über
+/// log_page_buf (nur neu gelesen, wenn dort eine andere Seite steht). Flash muss geöffnet sein.
+static const uint8_t *log_page_image(uint16_t page)
+{
+    if (page == log_head_page)
+        return log_head_buf;
+    if (log_page_buf_page != page)
+    {
+        Flash_ReadData(log_page_address(page), log_page_buf, FLASH_PAGE_SIZE_BYTES);
+        log_page_buf_page = page;
+    }
+    return log_page_buf;
+}
+
+/// Positioniert einen Cursor auf den Datensatz index. Flash muss geöffnet sein.
+static bool log_cursor_seek(log_cursor_t *c, uint32_t index)
+{
+    log_page_header_t hdr;
+
+    if (!log_find_page(index, &c->page) || !log_parse_header(log_page_image(c->page), &hdr))
+        return FALSE;
+
+    if (!log_reader_start(&c->rd, log_page_image(c->page), hdr.format) ||
+        !log_reader_skip(&c->rd, (uint16_t)(index - hdr.seq)))
+        return FALSE;
+    c->index = index;
+    return TRUE;
+}
+
+/// Setzt einen Cursor an den Anfang einer Seite. FALSE bei unlesbarem Kopf oder
+/// falscher Daten-CRC. Flash muss geöffnet sein.
+static bool log_cursor_start_page(log_cursor_t *c, uint16_t page)
+{
+    log_page_header_t hdr;
+    const uint8_t *image = log_page_image(page);
+
+    if (!log_parse_header(image, &hdr) || !log_reader_start(&c->rd, image, hdr.format))
+        return FALSE;
+    c->page = page;
+    c->index = hdr.seq; // überspringt ggf. unlesbare Datensätze der vorigen Seite
+    return TRUE;
+}
+
+/// Wechselt zur nächsten Seite mit gültigem Kopf (höchstens bis zur Kopfseite).
+static bool log_cursor_next_page(log_cursor_t *c)
+{
+    uint16_t page = c->page;
+
+    while (page != log_head_page)
+    {
+        page = (page + 1 >= FLASH_LOG_PAGES) ? 0 : page + 1;
+        if (log_cursor_start_page(c, page))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/// Dekodiert den nächsten Datensatz des Cursors, auch über Seitengrenzen. Flash muss geöffnet sein.
+static log_read_result_t log_cursor_step(log_cursor_t *c, log_entry_t *e)
+{
+    for (;;)
+    {
+        // ältester Sektor inzwischen gelöscht oder Ende des Logs erreicht
+        if (c->index < log_tail_seq || c->index >= flash_get_count())
+            return LOG_READ_END;
+
+        // Kopfseite liegt im RAM, andere Seiten in log_page_buf; Bezug daher jedes Mal erneuern
+        c->rd.page = log_page_image(c->page);
+        log_read_result_t r = log_reader_next(&c->rd, e);
+        if (r != LOG_READ_END)
+        {
+            c->index++;
+            return r;
+        }
+        if (!log_cursor_next_page(c))
+            return LOG_READ_END;
+    }
+}
+
+/// Ende der kodierten Daten im RAM-Abbild der Kopfseite (Byte-Offset, aufgerundet)
+static uint16_t log_head_end(void)
+{
+    if (log_head_fill == 0)
+        return LOG_PAGE_HEADER_SIZE;
+    if (log_head_format == LOG_FORMAT_DELTA)
+        return LOG_DELTA_DATA_OFFSET + (log_head_delta.bitpos + 7) / 8;
+    return LOG_PAGE_HEADER_SIZE + log_head_fill * LOG_SLOT_SIZE;
+}
+
+/// Merkt sich, bis wohin das RAM-Abbild im Flash steht. Ein teilweise belegtes
+/// letztes Byte wird beim nächsten Programmieren erneut mitgeschrieben.
+static void log_head_mark_flushed(void)
+{
+    log_head_flushed = log_head_end();
+    if (log_head_fill > 1 && log_head_format == LOG_FORMAT_DELTA && (log_head_delta.bitpos & 7))
+        log_head_flushed--;
+}
+
+/// Legt das RAM-Abbild einer neuen, leeren Kopfseite an.
+static void log_head_start_page(void)
+{
+    memset(log_head_buf, 0xFF, sizeof(log_head_buf));
+    log_build_header(log_head_buf, LOG_FORMAT_WRITE, log_head_seq);
+    log_head_format = LOG_FORMAT_WRITE;
+    log_head_flushed = 0;
+    log_head_session = 0;
+    log_head_pending = FALSE;
+}
+
+/// Wechselt auf die nächste unbeschriebene Seite im Ring. Beim Übergang in einen
+/// neuen Sektor muss dieser bereits gelöscht sein; sonst FALSE (Log voll).
+static bool log_head_next_page(void)
+{
+    uint16_t page = log_head_page;
+    uint8_t erased = log_erased_sectors;
+
+    if (!log_flash_acquire())
+        return FALSE;
+
+    do
+    {
+        page = (page + 1 >= FLASH_LOG_PAGES) ? 0 : page + 1;
+        if (page % LOG_PAGES_PER_SECTOR == 0)
+        {
+            if (erased == 0)
+                return FALSE;
+            erased--;
+        }
+    } while (!log_page_is_blank(page)); // angefangene Seitenköpfe (z. B. Stromausfall) überspringen
+
+    log_head_seq += log_head_fill;
+    log_head_page = page;
+    log_head_fill = 0;
+    log_erased_sectors = erased;
+    log_head_start_page();
+    return TRUE;
+}
+
+/// Beginnt eine Puffer-Sitzung: Markierung "geöffnet" programmieren, bei einer
+/// neuen Seite zusammen mit dem Seitenkopf.
+static bool log_head_open_session(void)
+{
+    uint32_t addr = log_page_address(log_head_page);
+
+    if (!log_flash_acquire())
+        return FALSE;
+
+    if (log_head_session < 8)
+        log_head_buf[LOG_PAGE_OPEN_OFFSET] &= (uint8_t)~(1 << log_head_session);
+
+    if (log_head_flushed == 0)
+    {
+        if (!Flash_PageProgram(addr, log_head_buf, LOG_PAGE_HEADER_SIZE))
+            return FALSE;
+        log_head_flushed = LOG_PAGE_HEADER_SIZE;
+    }
+    else if (log_head_session < 8)
+    {
+        if (!Flash_PageProgram(addr + LOG_PAGE_OPEN_OFFSET, &log_head_buf[LOG_PAGE_OPEN_OFFSET], 1))
+            return FALSE;
+    }
+
+    log_head_pending = TRUE;
+    return TRUE;
+}
+
+/// Programmiert die gepufferten Daten der Kopfseite und schließt die Sitzung ab.
+static bool log_head_flush(void)
+{
+    uint32_t addr = log_page_address(log_head_page);
+    uint16_t end = log_head_end();
+
+    if (!log_head_pending)
+        return TRUE;
+
+    if (!log_flash_acquire())
+        return FALSE;
+
+    if (end > log_head_flushed &&
+        !Flash_PageProgram(addr + log_head_flushed, &log_head_buf[log_head_flushed], end - log_head_flushed))
+        return FALSE;
+
+    if (log_head_session < 8)
+    {
+        // schließt auch eine beim Start als verloren erkannte Sitzung mit ab
+        log_head_buf[LOG_PAGE_COMMIT_OFFSET] &= (uint8_t)~((2U << log_head_session) - 1);
+        if (!Flash_PageProgram(addr + LOG_PAGE_COMMIT_OFFSET, &log_head_buf[LOG_PAGE_COMMIT_OFFSET], 1))
+            return FALSE;
+        log_head_session++;
+    }
+
+    log_head_mark_flushed();
+    log_head_pending = FALSE;
+    return TRUE;
+}
+
+/// Schließt die volle Kopfseite ab: programmiert die Daten-CRC (nur LOG_FORMAT_DELTA).
+static bool log_head_seal(void)
+{
+    uint8_t *crc = &log_head_buf[LOG_DELTA_CRC_OFFSET];
+
+    if (log_head_format != LOG_FORMAT_DELTA || crc[0] != 0xFF || crc[1] != 0xFF)
+        return TRUE; // kein Format mit Daten-CRC oder schon abgeschlossen
+
+    if (!log_flash_acquire())
+        return FALSE;
+    crc[0] = log_page_crc(log_head_buf);
+    crc[1] = (uint8_t)~crc[0];
+    return Flash_PageProgram(log_page_address(log_head_page) + LOG_DELTA_CRC_OFFSET, crc, 2);
+}
+
+//////// Zwischenspeicher und Batch-Übernahme
+//
+// Der Hochtemperaturmodus lagert volle RAM-Puffer in den reservierten Sektor 0
+// aus: gepackte 5-Byte-Datensätze, 51 je Seite, fortlaufend ab Adresse 0.
+// Die Übernahme ins Log ist ein Zwei-Phasen-Commit: vorher ein Beginn-Eintrag
+// im EEPROM-Journal (erster Index, Anzahl, CRC-8 über die Datensätze), danach
+// Übertragen, Programmieren, Löschen des Zwischenspeichers und ein
+// Ende-Eintrag. Ein unterbrochener Stapel wird beim Start aus dem
+// Zwischenspeicher fortgesetzt oder anhand der CRC im Log bestätigt.
+
+#define LOG_STAGE_ADDR 0x000000UL
+#define LOG_STAGE_PER_PAGE (FLASH_PAGE_SIZE_BYTES / RECORD_SIZE_BYTES)
+#define LOG_STAGE_CAPACITY ((uint16_t)(FLASH_SECTOR_SIZE_BYTES / FLASH_PAGE_SIZE_BYTES) * LOG_STAGE_PER_PAGE)
+#define LOG_STAGE_CHUNK ((FLASH_WRITE_CHUNK_BYTES / RECORD_SIZE_BYTES) * RECORD_SIZE_BYTES)
+
+#define LOG_BATCH_OPEN 0x01
+#define LOG_BATCH_DONE 0x02
+#define LOG_BATCH_ABORTED 0x03
+#define LOG_BATCH_SIZE 8 // Zustand, erster Index (4), Anzahl (2), CRC
+
+static eeprom_journal_t log_batch_journal = EEPROM_JOURNAL(EEPROM_ADDR_JOURNAL_BATCH, LOG_BATCH_SIZE, EEPROM_JOURNAL_BATCH_SLOTS);
+EEPROM_JOURNAL_ASSERT(log_batch, EEPROM_ADDR_JOURNAL_BATCH, LOG_BATCH_SIZE, EEPROM_JOURNAL_BATCH_SLOTS, EEPROM_ADDR_END);
+
+/// CRC über die gepackte Form eines Datensatzes; das Verlust-Flag setzt erst das Log.
+static uint8_t log_batch_crc(uint8_t crc, const log_entry_t *e)
+{
+    log_entry_t tmp = *e;
+    uint8_t raw[RECORD_SIZE_BYTES];
+
+    tmp.flags &= (uint8_t)~RECORD_FLAG_DATA_LOST;
+    entry_pack(&tmp, raw);
+    return crc8_update(crc, raw, RECORD_SIZE_BYTES);
+}
+
+static void log_batch_mark(uint8_t state, uint32_t first, uint16_t count, uint8_t crc)
+{
+    uint8_t buf[LOG_BATCH_SIZE];
+    buf[0] = state;
+    buf[1] = (uint8_t)(first >> 24);
+    buf[2] = (uint8_t)(first >> 16);
+    buf[3] = (uint8_t)(first >> 8);
+    buf[4] = (uint8_t)first;
+    buf[5] = (uint8_t)(count >> 8);
+    buf[6] = (uint8_t)count;
+    buf[7] = crc;
+    storage_journal_write(&log_batch_journal, buf);
+}
+
+static uint32_t log_stage_address(uint16_t index)
+{
+    return LOG_STAGE_ADDR + (uint32_t)(index / LOG_STAGE_PER_PAGE) * FLASH_PAGE_SIZE_BYTES +
+           (index % LOG_STAGE_PER_PAGE) * RECORD_SIZE_BYTES;
+}
+
+/// Liest einen Datensatz des Zwischenspeichers. Flash muss geöffnet sein.
+static bool log_stage_read(uint16_t index, log_entry_t *e)
+{
+    uint8_t raw[RECORD_SIZE_BYTES];
+    Flash_ReadData(log_stage_address(index), raw, RECORD_SIZE_BYTES);
+    return entry_unpack(raw, e);
+}
+
+/// Löscht den Zwischenspeicher. Flash muss geöffnet sein.
+static bool log_stage_erase(void)
+{
+    log_stage_blank = FALSE;
+    if (!Flash_SectorErase(LOG_STAGE_ADDR))
+        return FALSE;
+    log_stage_count = 0;
+    log_stage_crc = 0;
+    log_stage_blank = TRUE;
+    return TRUE;
+}
+
+/// Zählt die gültigen Datensätze des Zwischenspeichers (nutzt log_page_buf). Flash muss geöffnet sein.
+static void log_stage_scan(void)
+{
+    log_entry_t e;
+
+    log_stage_count = 0;
+    log_stage_crc = 0;
+    log_stage_blank = TRUE;
+    log_page_buf_page = LOG_PAGE_NONE;
+    while (log_stage_count < LOG_STAGE_CAPACITY)
+    {
+        uint8_t slot = log_stage_count % LOG_STAGE_PER_PAGE;
+        const uint8_t *raw = &log_page_buf[slot * RECORD_SIZE_BYTES];
+
+        if (slot == 0)
+            Flash_ReadData(log_stage_address(log_stage_count), log_page_buf, FLASH_PAGE_SIZE_BYTES);
+        if (log_is_blank(raw, RECORD_SIZE_BYTES))
+            return;
+        if (!entry_unpack(raw, &e))
+        {
+            log_stage_blank = FALSE; // beschädigt: vor dem nächsten Auslagern übernehmen bzw. löschen
+            return;
+        }
+        log_stage_crc = log_batch_crc(log_stage_crc, &e);
+        log_stage_count++;
+    }
+}
+
+void storage_init(void)
+{
+    log_page_header_t hdr;
+    uint16_t page;
+    uint8_t head_sector = 0;
+    bool found = FALSE;
+
+    log_head_page = 0;
+    log_head_fill = 0;
+    log_head_seq = 0;
+    log_tail_sector = 0;
+    log_tail_seq = 0;
+    log_acked_sectors = 0;
+    log_erased_sectors = 0;
+    log_data_lost = FALSE;
+    log_page_buf_page = LOG_PAGE_NONE;
+    log_block_open = FALSE;
+    log_stage_open = FALSE;
+    log_head_start_page();
+
+    if (!log_flash_acquire())
+        return;
+
+    // Kopfsektor (höchste Sequenznummer) und ältesten Sektor (niedrigste) bestimmen
+    for (uint8_t sector = 0; sector < FLASH_LOG_SECTORS; ++sector)
+    {
+        if (!log_sector_first_page(sector, &page, &hdr))
+            continue;
+        if (!found || hdr.seq > log_head_seq)
+        {
+            head_sector = sector;
+            log_head_seq = hdr.seq;
+        }
+        if (!found || hdr.seq < log_tail_seq)
+        {
+            log_tail_sector = sector;
+            log_tail_seq = hdr.seq;
+        }
+        found = TRUE;
+    }
+
+    if (found)
+    {
+        // letzte Seite mit gültigem Kopf im Kopfsektor
+        uint16_t lo = (uint16_t)head_sector * LOG_PAGES_PER_SECTOR;
+        for (page = lo + 1; page < (uint16_t)(head_sector + 1) * LOG_PAGES_PER_SECTOR; ++page)
+        {
+            if (log_read_header(page, &hdr))
+                lo = page;
+        }
+
+        // Kopfseite ins RAM-Abbild laden und dekodieren: Anzahl Datensätze und Codec-Zustand
+        log_page_reader_t rd;
+        log_entry_t e;
+        Flash_ReadData(log_page_address(lo), log_head_buf, FLASH_PAGE_SIZE_BYTES);
+        log_parse_header(log_head_buf, &hdr);
+        log_reader_start(&rd, log_head_buf, hdr.format); // Daten-CRC unerheblich: nur Füllstand bestimmen
+        while (log_reader_next(&rd, &e) != LOG_READ_END)
+            ;
+
+        log_head_seq = hdr.seq;
+        log_head_page = lo;
+        log_head_fill = rd.index;
+        log_head_format = hdr.format;
+        log_head_delta = rd.delta;
+        log_head_mark_flushed();
+
+        // Sitzung geöffnet, aber nie übernommen: gepufferte Datensätze sind verloren
+        uint8_t opened = log_count_marks(log_head_buf[LOG_PAGE_OPEN_OFFSET]);
+        log_head_session = log_count_marks(log_head_buf[LOG_PAGE_COMMIT_OFFSET]);
+        if (opened > log_head_session)
+        {
+            log_data_lost = TRUE;
+            log_head_session = opened;
+#if defined(DEBUG_STORAGE_C)
+            DebugLn("[storage] Gepufferte Datensätze verloren");
+#endif
+        }
+
+        // bereits übertragene Sektoren ab dem ältesten zählen
+        for (uint8_t sector = log_tail_sector; sector != head_sector && log_sector_is_acked(sector);
+             sector = log_sector_next(sector))
+            log_acked_sectors++;
+    }
+    else
+    {
+        // leeres Log: im ersten Sektor auf gelöschtem Flash beginnen
+        log_sector_erase(0);
+    }
+
+    // bereits gelöschte Sektoren vor dem Schreibkopf zählen
+    for (uint8_t sector = log_sector_next(head_sector);
+         log_erased_sectors < LOG_ERASE_AHEAD_SECTORS && sector != head_sector &&
+         !(found && sector == log_tail_sector) && log_sector_is_blank(sector);
+         sector = log_sector_next(sector))
+        log_erased_sectors++;
+
+    log_stage_scan();
+    log_flash_release();
+
+#if defined(DEBUG_STORAGE_C)
+    DebugUVal("[storage] Log-Kopf Seite ", log_head_page, "");
+    DebugULong("[storage] Datensätze ", flash_get_count(), "");
+    DebugULong("[storage] Ältester ", log_tail_seq, "");
+#endif
+}
+
+uint32_t flash_get_count(void)
+{
+    return log_head_seq + log_head_fill;
+}
+
+uint32_t flash_get_first(void)
+{
+    return log_tail_seq;
+}
+
+void flash_ack_records(uint32_t upto)
+{
+    uint8_t head_sector = log_sector_of(log_head_page);
+    uint8_t sector = (uint8_t)((log_tail_sector + log_acked_sectors) % FLASH_LOG_SECTORS);
+    uint8_t mark = 0x00;
+
+    // Der Kopfsektor wird nie markiert, er wird noch beschrieben.
+    while (sector != head_sector)
+    {
+        uint8_t next = log_sector_next(sector);
+        uint16_t page;
+        log_page_header_t hdr;
+
+        if (!log_flash_acquire() || log_sector_seq(next) > upto)
+            break; // Sektor enthält noch nicht übertragene Datensätze
+
+        if (log_sector_first_page(sector, &page, &hdr))
+            Flash_PageProgram(log_page_address(page) + LOG_PAGE_ACK_OFFSET, &mark, 1);
+        log_acked_sectors++;
+        sector = next;
+    }
+    log_flash_release();
+}
+
+void storage_maintenance(void)
+{
+    uint8_t head_sector = log_sector_of(log_head_page);
+
+    while (log_erased_sectors < LOG_ERASE_AHEAD_SECTORS)
+    {
+        uint8_t sector = (uint8_t)((head_sector + 1 + log_erased_sectors) % FLASH_LOG_SECTORS);
+        bool is_tail = (sector == log_tail_sector && log_tail_sector != head_sector);
+
+        if (sector == head_sector || (is_tail && log_acked_sectors == 0))
+            break; // älteste Datensätze noch nicht übertragen: nichts verwerfen
+
+        if (!log_flash_acquire() || !log_sector_erase(sector))
+            break;
+        log_erased_sectors++;
+
+        if (is_tail)
+        {
+            // ältester Sektor ist gelöscht: nächster Sektor enthält die ältesten Datensätze
+            log_acked_sectors--;
+            log_tail_sector = log_sector_next(sector);
+            log_tail_seq = log_sector_seq(log_tail_sector);
+        }
+    }
+    log_flash_release();
+}
+
+/// Hängt einen Datensatz an das RAM-Abbild der Kopfseite an und programmiert bei Bedarf.
+static bool log_append(const log_entry_t *e)
+{
+    // Kopfseite voll oder in fremdem Format: Rest programmieren und neue Seite beginnen
+    if (log_head_format != LOG_FORMAT_WRITE ||
+        (log_head_fill > 0 &&
+         ((log_head_format == LOG_FORMAT_DELTA &&
+           log_head_delta.bitpos + log_delta_encode(&log_head_delta, e, 0, 0) > LOG_DELTA_BITS) ||
+          (log_head_format == LOG_FORMAT_PACKED5 && log_head_fill >= LOG_SLOTS_PER_PAGE))))
+    {
+        if (!log_head_flush() || !log_head_seal())
+            return FALSE;
+        if (!log_head_next_page())
+        {
+#if defined(DEBUG_STORAGE_C)
+            DebugLn("[Flash] Log voll");
+#endif
+            return FALSE;
+        }
+    }
+
+    if (!log_head_pending && !log_head_open_session())
+        return FALSE;
+
+    if (log_head_fill > 0 && log_head_format == LOG_FORMAT_DELTA)
+    {
+        uint8_t nbits = log_delta_encode(&log_head_delta, e, &log_head_buf[LOG_DELTA_DATA_OFFSET], log_head_delta.bitpos);
+        log_delta_advance(&log_head_delta, e, nbits);
+    }
+    else
+    {
+        entry_pack(e, &log_head_buf[log_head_end()]);
+        if (log_head_fill == 0)
+            log_delta_start(&log_head_delta, e);
+    }
+    log_head_fill++;
+
+    // Block voll oder keine Sitzungsmarkierung mehr frei: jetzt programmieren
+    if (log_head_session >= 8 || log_head_end() - log_head_flushed >= FLASH_WRITE_CHUNK_BYTES)
+        return log_head_flush();
+    return TRUE;
+}
+
+//////// Datensätze
+
+bool flash_write_record(const record_t *rec) // external flash
+{
+    if (!rec)
+        return FALSE;
+
+    log_entry_t e;
+    entry_from_record(rec, &e);
+    if (log_data_lost)
+        e.flags |= RECORD_FLAG_DATA_LOST;
+#if defined(DEBUG_STORAGE_C)
+    DebugLn("[Flash] Schreibe Datensatz ins Flash");
+    DebugULong("-> Timestamp", e.ts, "");
+    DebugUVal("-> Temp*16", e.temp, "");
+    DebugUVal("-> Flags", e.flags, "");
+#endif
+    bool ok = log_append(&e);
+    if (ok)
+        log_data_lost = FALSE;
+
+    log_flash_release();
+
+    if (!ok)
+        DebugLn("[Flash] Schreiben fehlgeschlagen");
+
+    return ok;
+}
+
+bool storage_flush(void)
+{
+    bool ok = log_head_flush();
+    log_flash_release();
+
+    if (!ok)
+        DebugLn("[Flash] Schreiben fehlgeschlagen");
+
+    return ok;
+}
+
+//////// Zwischenspeicher und Batch-Übernahme (Schnittstelle)
+
+/// CRC über n Datensätze des Logs ab first. Flash muss geöffnet sein.
+static bool log_range_crc(uint32_t first, uint16_t n, uint8_t *crc)
+{
+    log_cursor_t c;
+    log_entry_t e;
+
+    if (n == 0)
+        return TRUE;
+    if (!log_cursor_seek(&c, first))
+        return FALSE;
+    for (uint16_t i = 0; i < n; ++i)
+    {
+        if (log_cursor_step(&c, &e) != LOG_READ_OK)
+            return FALSE;
+        *crc = log_batch_crc(*crc, &e);
+    }
+    return TRUE;
+}
+
+/// Übernimmt den Zwischenspeicher ins Log bzw. setzt eine begonnene Übernahme fort.
+/// Flash muss geöffnet sein.
+static bool log_commit_staged(void)
+{
+    log_entry_t e;
+
+    if (log_stage_count == 0)
+        return TRUE;
+
+    if (!log_stage_open)
+    {
+        log_stage_first = flash_get_count();
+        log_stage_open = TRUE;
+        log_batch_mark(LOG_BATCH_OPEN, log_stage_first, log_stage_count, log_stage_crc);
+    }
+
+    // bereits übernommene Datensätze überspringen
+    for (uint16_t i = (uint16_t)(flash_get_count() - log_stage_first); i < log_stage_count; ++i)
+    {
+        if (!log_stage_read(i, &e))
+            return FALSE;
+        if (log_data_lost)
+            e.flags |= RECORD_FLAG_DATA_LOST;
+        if (!log_append(&e))
+            return FALSE;
+        log_data_lost = FALSE;
+    }
+
+    // Zwischenspeicher erst löschen, wenn alles programmiert ist; danach Ende-Eintrag
+    uint16_t count = log_stage_count;
+    uint8_t crc = log_stage_crc;
+    if (!log_head_flush() || !log_stage_erase())
+        return FALSE;
+    log_batch_mark(LOG_BATCH_DONE, log_stage_first, count, crc);
+    log_stage_open = FALSE;
+    return TRUE;
+}
+
+bool flash_stage_records(timestamp_t base_ts, uint8_t flags, const record_compact_t *recs, uint16_t count) // external flash
+{
+    if (!recs)
+        return FALSE;
+
+    bool ok = log_flash_acquire();
+    uint16_t done = 0;
+    while (ok && done < count)
+    {
+        // kein unbeschriebener Platz mehr: bisherigen Inhalt ins Log übernehmen
+        if (!log_stage_blank || log_stage_count >= LOG_STAGE_CAPACITY)
+        {
+            ok = (log_stage_count > 0) ? log_commit_staged() : log_stage_erase();
+            continue;
+        }
+
+        // Datensätze bis zum Seitenende in Blöcken zu LOG_STAGE_CHUNK Byte programmieren
+        uint8_t chunk[LOG_STAGE_CHUNK];
+        uint8_t slot = log_stage_count % LOG_STAGE_PER_PAGE;
+        uint8_t n = 0;
+        while (done + n < count && slot + n < LOG_STAGE_PER_PAGE && (uint16_t)(n + 1) * RECORD_SIZE_BYTES <= LOG_STAGE_CHUNK)
+        {
+            log_entry_t e;
+            entry_from_compact(base_ts, flags, &recs[done + n], &e);
+            entry_pack(&e, &chunk[n * RECORD_SIZE_BYTES]);
+            log_stage_crc = log_batch_crc(log_stage_crc, &e);
+            n++;
+        }
+
+        if (!Flash_PageProgram(log_stage_address(log_stage_count), chunk, (uint16_t)n * RECORD_SIZE_BYTES))
+        {
+            log_stage_blank = FALSE; // Zustand der Slots unbekannt, Rest ist verloren
+            ok = FALSE;
+            break;
+        }
+        log_stage_count += n;
+        done += n;
+    }
+    log_flash_release();
+
+    if (!ok)
+        DebugLn("[Flash] Auslagern fehlgeschlagen");
+    return ok;
+}
+
+uint16_t flash_staged_count(void)
+{
+    return log_stage_count;
+}
+
+bool flash_commit_staged(void) // external flash
+{
+    bool ok = log_flash_acquire() && log_commit_staged();
+    log_flash_release();
+    return ok;
+}
+
+bool flash_commit_records(timestamp_t base_ts, uint8_t flags, const record_compact_t *recs, uint16_t count) // external flash
+{
+    return flash_stage_records(base_ts, flags, recs, count) && flash_commit_staged();
+}
+
+bool storage_recover_commit(void)
+{
+    uint8_t buf[LOG_BATCH_SIZE];
+    if (!storage_journal_read(&log_batch_journal, buf) || buf[0] != LOG_BATCH_OPEN)
+        return TRUE;
+
+    uint32_t first = ((uint32_t)buf[1] << 24) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 8) | buf[4];
+    uint16_t count = ((uint16_t)buf[5] << 8) | buf[6];
+    uint8_t crc = buf[7];
+    uint32_t in_log = (flash_get_count() > first) ? flash_get_count() - first : 0;
+    bool staged = (log_stage_count == count && log_stage_crc == crc);
+    bool ok = FALSE;
+
+    if (first >= log_tail_seq && log_flash_acquire())
+    {
+        if (staged && in_log <= count)
+        {
+            // Stapel liegt noch im Zwischenspeicher: übernommenen Anfang prüfen, Rest nachholen
+            uint8_t crc_log = 0;
+            uint8_t crc_stage = 0;
+            log_entry_t e;
+
+            ok = log_range_crc(first, (uint16_t)in_log, &crc_log);
+            for (uint16_t i = 0; ok && i < (uint16_t)in_log; ++i)
+            {
+                ok = log_stage_read(i, &e);
+                crc_stage = log_batch_crc(crc_stage, &e);
+            }
+            if (ok && crc_log == crc_stage)
+            {
+                log_stage_first = first;
+                log_stage_open = TRUE;
+                ok = log_commit_staged();
+            }
+            else
+            {
+                ok = FALSE;
+            }
+        }
+        else if (!staged && in_log >= count)
+        {
+            // Zwischenspeicher schon gelöscht: nur der Ende-Eintrag fehlt
+            uint8_t crc_log = 0;
+            ok = log_range_crc(first, count, &crc_log) && crc_log == crc;
+            if (ok)
+                log_batch_mark(LOG_BATCH_DONE, first, count, crc);
+        }
+    }
+
+    if (!ok)
+    {
+        // nicht rekonstruierbar: Stapel verwerfen, Lücke am nächsten Datensatz kennzeichnen
+        log_stage_open = FALSE;
+        if (staged)
+            log_stage_erase();
+        log_data_lost = TRUE;
+        log_batch_mark(LOG_BATCH_ABORTED, first, count, crc);
+    }
+    log_flash_release();
+
+#if defined(DEBUG_STORAGE_C)
+    DebugUVal("[storage] Offener Stapel abgeschlossen: ", ok, "");
+#endif
+    return ok;
+}
+
+bool flash_read_record(uint32_t index, record_t *out) // external flash
+{
+    if (!out)
+        return FALSE;
+
+    bool ok = FALSE;
+    log_cursor_t c;
+    log_entry_t e;
+    if (log_flash_acquire() && log_cursor_seek(&c, index) && log_cursor_step(&c, &e) == LOG_READ_OK)
+    {
+        entry_to_record(&e, out);
+        ok = TRUE;
+    }
+
+    log_flash_release();
+    return ok;
+}
+
+//////// Blockweises Lesen (kodierte Seiten)
+
+/// Beschreibt eine Seite mit gültigem Kopf. Flash muss geöffnet sein.
+static bool log_block_describe(uint16_t page, flash_block_t *blk)
+{
+    log_page_header_t hdr;
+
+    if (page == log_head_page)
+    {
+        if (!log_parse_header(log_head_buf, &hdr))
+            return FALSE;
+        blk->end = log_head_seq + log_head_fill;
+        blk->len = log_head_end();
+    }
+    else
+    {
+        // Seite mit falscher Daten-CRC wird nicht übertragen
+        const uint8_t *image = log_page_image(page);
+        if (!log_parse_header(image, &hdr) || !log_page_crc_ok(image, hdr.format))
+            return FALSE;
+        // Ende = erster Datensatz der nächsten lesbaren Seite
+        uint16_t next = page;
+        log_page_header_t next_hdr;
+        do
+        {
+            next = (next + 1 >= FLASH_LOG_PAGES) ? 0 : next + 1;
+        } while (next != log_head_page && !log_read_header(next, &next_hdr));
+        blk->end = (next == log_head_page) ? log_head_seq : next_hdr.seq;
+        blk->len = FLASH_PAGE_SIZE_BYTES;
+    }
+    blk->page = page;
+    blk->first = hdr.seq;
+    return TRUE;
+}
+
+bool flash_block_open(uint32_t index, flash_block_t *blk)
+{
+    flash_block_close();
+
+    if (!blk || !log_flash_acquire())
+        return FALSE;
+    log_block_open = TRUE;
+    // defekte Seite: mit der nächsten lesbaren beginnen
+    if (log_find_page(index, &blk->page) && (log_block_describe(blk->page, blk) || flash_block_next(blk)))
+        return TRUE;
+    flash_block_close();
+    return FALSE;
+}
+
+bool flash_block_next(flash_block_t *blk)
+{
+    uint16_t page = blk->page;
+
+    if (!log_block_open)
+        return FALSE;
+    while (page != log_head_page)
+    {
+        page = (page + 1 >= FLASH_LOG_PAGES) ? 0 : page + 1;
+        if (log_block_describe(page, blk))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+uint8_t flash_block_read(const flash_block_t *blk, uint16_t offset, uint8_t *out, uint8_t max)
+{
+    uint16_t n;
+
+    if (!log_block_open || offset >= blk->len)
+        return 0;
+    n = blk->len - offset;
+    if (n > max)
+        n = max;
+
+    // Kopfseite aus dem RAM, sonst log_page_buf (bei Wechsel zwischen Seiten neu gelesen)
+    const uint8_t *image = log_page_image(blk->page);
+    if (!log_page_crc_ok(image, image[1]))
+        return 0;
+    memcpy(out, image + offset, n);
+    return (uint8_t)n;
+}
+
+void flash_block_close(void)
+{
+    if (!log_block_open)
+        return;
+    log_block_open = FALSE;
+    log_flash_release();
+}
 /*
 bool flash_write_record_nolock(const record_t *rec) // external flash
 {
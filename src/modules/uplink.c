@@ -0,0 +1,257 @@
+#include "modules/uplink.h"
+#include "modules/settings.h"
+#include "modules/packet_handler.h"
+#include "periphery/RFM69.h"
+#include "utility/debug.h"
+#include "utility/crc8.h"
+#include "utility/random.h"
+
+#ifndef RFM_REG_PA_LEVEL
+#define RFM_REG_PA_LEVEL 0x11   ///< RegPaLevel: Bit 7-5 PA-Auswahl, Bit 4-0 OutputPower (1 dB-Schritte)
+#endif
+#ifndef RFM_REG_RSSI_VALUE
+#define RFM_REG_RSSI_VALUE 0x24 ///< RegRssiValue: -RSSI * 2 dBm
+#endif
+
+static uint8_t uplink_frame[UPLINK_FRAME_SIZE]; ///< Rahmen wird direkt aus dem Flash befüllt
+static uint32_t uplink_airtime = 0;              ///< geschätzte Funkzeit in ms (uplink_airtime_ms())
+static uint16_t uplink_srtt = 0;                 ///< geglättete Antwortzeit in ms, 0 = noch keine Messung
+static uint16_t uplink_rttvar = 0;               ///< mittlere Abweichung der Antwortzeit in ms
+static uint8_t uplink_rto_shift = 0;             ///< Verdopplungen des Timeouts seit der letzten Quittung
+static uint8_t uplink_pa_level = 0;              ///< RegPaLevel zu Beginn der Sitzung (volle Leistung)
+static uint8_t uplink_pa_reduction = 0;          ///< aktuelle Absenkung der Sendeleistung in dB
+static uint8_t uplink_slot = 0;                  ///< vom Gateway zugewiesener Sendeslot + 1, 0 = keiner
+
+/// Neue Messung der Antwortzeit (Rahmen gesendet bis Quittung empfangen)
+static void uplink_rtt_sample(uint16_t rtt)
+{
+    if (uplink_srtt == 0)
+    {
+        uplink_srtt = rtt;
+        uplink_rttvar = rtt / 2;
+    }
+    else
+    {
+        uint16_t err = (rtt > uplink_srtt) ? rtt - uplink_srtt : uplink_srtt - rtt;
+        uplink_rttvar = uplink_rttvar - uplink_rttvar / 4 + err / 4;
+        uplink_srtt = uplink_srtt - uplink_srtt / 8 + rtt / 8;
+    }
+    uplink_rto_shift = 0;
+}
+
+/// Schreibt die um uplink_pa_reduction abgesenkte Sendeleistung
+static void uplink_tx_power_apply(void)
+{
+    RFM69_WriteReg(RFM_REG_PA_LEVEL, (uint8_t)(uplink_pa_level - uplink_pa_reduction));
+}
+
+/// Sendeleistung nach einer Quittung (RSSI) oder ihrem Ausbleiben anpassen
+static void uplink_tx_power_adapt(bool acked)
+{
+#if DT_XFER_TX_POWER_ADAPT
+    if (!acked)
+    {
+        ///////// Verlust: sofort zurück auf volle Leistung
+        if (uplink_pa_reduction)
+        {
+            uplink_pa_reduction = 0;
+            uplink_tx_power_apply();
+        }
+        return;
+    }
+
+    int16_t rssi = -(int16_t)(RFM69_ReadReg(RFM_REG_RSSI_VALUE) / 2);
+    if (rssi >= DT_XFER_RSSI_TARGET_DBM + UPLINK_RSSI_HYSTERESIS_DB)
+    {
+        if (uplink_pa_reduction < DT_XFER_TX_POWER_MAX_REDUCTION && uplink_pa_reduction < (uplink_pa_level & 0x1F))
+        {
+            uplink_pa_reduction++;
+            uplink_tx_power_apply();
+        }
+    }
+    else if (rssi < DT_XFER_RSSI_TARGET_DBM && uplink_pa_reduction)
+    {
+        uplink_pa_reduction--;
+        uplink_tx_power_apply();
+    }
+#endif
+}
+
+/// Sendedauer eines Pakets mit len Byte Nutzlast in ms (aufgerundet)
+static uint16_t uplink_tx_ms(uint8_t len)
+{
+    return (uint16_t)(((uint32_t)(len + UPLINK_AIR_OVERHEAD_BYTES) * 8000UL + UPLINK_BITRATE_BPS - 1) / UPLINK_BITRATE_BPS);
+}
+
+uint8_t uplink_send_block(const flash_block_t *blk, uint16_t offset, uint8_t seq, bool ack_request)
+{
+    uint8_t n = flash_block_read(blk, offset, &uplink_frame[UPLINK_BLOCK_HEADER_SIZE], UPLINK_BLOCK_DATA_MAX);
+    if (n == 0)
+        return 0;
+
+    uplink_frame[0] = ack_request ? UPLINK_HEADER_LOG_BLOCK_LAST : UPLINK_HEADER_LOG_BLOCK;
+    uplink_frame[1] = seq;
+    uplink_frame[2] = DEVICE_ID_MSB;
+    uplink_frame[3] = DEVICE_ID_LSB;
+    uplink_frame[4] = (uint8_t)(blk->first >> 24);
+    uplink_frame[5] = (uint8_t)(blk->first >> 16);
+    uplink_frame[6] = (uint8_t)(blk->first >> 8);
+    uplink_frame[7] = (uint8_t)(blk->first >> 0);
+    uplink_frame[8] = (uint8_t)offset;
+    uplink_frame[9] = n;
+    uplink_frame[UPLINK_BLOCK_HEADER_SIZE + n] = crc8_update(0, uplink_frame, UPLINK_BLOCK_HEADER_SIZE + n);
+
+    uplink_airtime += uplink_tx_ms(UPLINK_BLOCK_HEADER_SIZE + n + 1);
+    RFM69_SetModeTx();
+    if (!RFM69_Send(uplink_frame, UPLINK_BLOCK_HEADER_SIZE + n + 1, UPLINK_TX_TIMEOUT_MS))
+    {
+        DebugLn("[UPLNK]TxErr");
+        return 0;
+    }
+    return n;
+}
+
+/**
+ * Empfängt den Downlink cmd an dieses Gerät.
+ * @param seq erwartetes Byte 4 (Sequenznummer), NULL = beliebig
+ * @return Wartezeit bis zum Empfang in ms, 0 bei Timeout
+ */
+static uint16_t uplink_receive(uint8_t cmd, const uint8_t *seq, uint16_t timeout_ms, uint8_t *rx)
+{
+    RFM69_WriteReg(RFM_REG_IRQ_FLAGS2, 0x10); // FIFOReset
+    RFM69_SetModeRx();                        // neuer Sync
+
+    for (uint16_t t = 0; t < timeout_ms; t += UPLINK_RX_SLICE_MS)
+    {
+        uplink_airtime += UPLINK_RX_SLICE_MS;
+        if (!RFM69_ReceiveFixed8BytesECC(rx, UPLINK_RX_SLICE_MS))
+            continue;
+
+        ///////// Downlink an ein anderes Gerät oder Quittung eines früheren Fensters?
+        if (rx[0] != DOWNLINK_HEADER || rx[1] != cmd ||
+            rx[2] != DEVICE_ID_MSB || rx[3] != DEVICE_ID_LSB || (seq && rx[4] != *seq))
+            continue;
+
+        return t + UPLINK_RX_SLICE_MS;
+    }
+    return 0;
+}
+
+void uplink_send_ping(uint8_t kind, uint32_t num_records)
+{
+    uplink_frame[0] = UPLINK_HEADER_PING;
+    uplink_frame[1] = DEVICE_ID_MSB;
+    uplink_frame[2] = DEVICE_ID_LSB;
+    uplink_frame[3] = kind;
+    uplink_frame[4] = (uint8_t)(num_records >> 24);
+    uplink_frame[5] = (uint8_t)(num_records >> 16);
+    uplink_frame[6] = (uint8_t)(num_records >> 8);
+    uplink_frame[7] = (uint8_t)(num_records >> 0);
+    uplink_frame[8] = crc8_update(0, uplink_frame, UPLINK_PING_SIZE - 1);
+
+    uplink_airtime += uplink_tx_ms(UPLINK_PING_SIZE);
+    RFM69_SetModeTx();
+    if (!RFM69_Send(uplink_frame, UPLINK_PING_SIZE, UPLINK_TX_TIMEOUT_MS))
+        DebugLn("[UPLNK]TxErr");
+}
+
+bool uplink_wait_ping_ack(uint16_t timeout_ms, uplink_rtc_t *rtc)
+{
+    uint8_t rx[8];
+
+    if (!uplink_receive(CMD_ACK_SET_RTC, NULL, timeout_ms, rx))
+        return FALSE;
+
+    uint32_t v = ((uint32_t)rx[4] << 24) | ((uint32_t)rx[5] << 16) | ((uint32_t)rx[6] << 8) | rx[7];
+    rtc->year = 0;
+    if (v == 0)
+        return TRUE; // Gateway stellt die Uhr nicht
+
+    rtc->second = (uint8_t)(v & 0x3F);
+    rtc->minute = (uint8_t)((v >> 6) & 0x3F);
+    rtc->hour = (uint8_t)((v >> 12) & 0x1F);
+    rtc->day = (uint8_t)((v >> 17) & 0x1F);
+    rtc->month = (uint8_t)((v >> 22) & 0x0F);
+    rtc->year = (uint16_t)(2000 + (v >> 26));
+    if (rtc->month == 0 || rtc->month > 12 || rtc->day == 0 ||
+        rtc->hour > 23 || rtc->minute > 59 || rtc->second > 59)
+        rtc->year = UPLINK_RTC_INVALID;
+    return TRUE;
+}
+
+bool uplink_wait_window_ack(uint8_t ack_seq, uint16_t timeout_ms, uint16_t *received)
+{
+    uint8_t rx[8];
+    uint16_t rtt = uplink_receive(CMD_WINDOW_ACK, &ack_seq, timeout_ms, rx);
+
+    if (rtt)
+    {
+        uplink_tx_power_adapt(TRUE); // RSSI gilt noch für dieses Paket
+        *received = ((uint16_t)rx[5] << 8) | rx[6];
+        if (rx[7])
+            uplink_slot = rx[7];
+        uplink_rtt_sample(rtt);
+        return TRUE;
+    }
+    if (uplink_rto_shift < 4)
+        uplink_rto_shift++;
+    uplink_tx_power_adapt(FALSE);
+    return FALSE;
+}
+
+void uplink_session_start(void)
+{
+    uplink_airtime = 0;
+    uplink_srtt = 0;
+    uplink_rttvar = 0;
+    uplink_rto_shift = 0;
+    uplink_pa_level = RFM69_ReadReg(RFM_REG_PA_LEVEL);
+    uplink_pa_reduction = 0;
+}
+
+void uplink_session_end(void)
+{
+    if (uplink_pa_reduction)
+    {
+        uplink_pa_reduction = 0;
+        uplink_tx_power_apply();
+    }
+}
+
+uint32_t uplink_airtime_ms(void)
+{
+    return uplink_airtime;
+}
+
+uint8_t uplink_assigned_slot(void)
+{
+    return uplink_slot;
+}
+
+uint16_t uplink_ack_timeout_ms(void)
+{
+    uint32_t rto;
+
+    if (uplink_srtt == 0)
+        return DT_XFER_ACK_TIMEOUT;
+
+    rto = ((uint32_t)uplink_srtt + 4UL * uplink_rttvar + UPLINK_RX_SLICE_MS) << uplink_rto_shift;
+    if (rto < DT_XFER_ACK_TIMEOUT_MIN)
+        return DT_XFER_ACK_TIMEOUT_MIN;
+    if (rto > DT_XFER_ACK_TIMEOUT)
+        return DT_XFER_ACK_TIMEOUT;
+    return (uint16_t)rto;
+}
+
+uint16_t uplink_backoff_ms(uint8_t losses)
+{
+    uint16_t max = DT_XFER_BACKOFF_BASE_MS;
+
+    if (losses == 0)
+        return 0;
+    while (--losses && max < MAX_RESEND_DELAY_MS)
+        max <<= 1;
+    if (max > MAX_RESEND_DELAY_MS)
+        max = MAX_RESEND_DELAY_MS;
+    return max / 2 + random16() % (max / 2 + 1);
+}
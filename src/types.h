@@ -20,19 +20,67 @@
  */
 typedef uint32_t timestamp_t;
 
+/**
+ * @typedef temp_q4_t
+ * @brief Temperatur als Festkommawert in 1/16 °C
+ *
+ * Entspricht der Auflösung des Flash-Logs. Messwerte werden einmal an der
+ * Sensorschnittstelle umgerechnet, Vergleiche und Speicherung laufen ohne
+ * Gleitkomma; zurück nach °C nur für Debug-Ausgaben und Bibliotheksaufrufe.
+ */
+typedef int16_t temp_q4_t;
+
+/// °C -> temp_q4_t (gerundet), nur für Konstanten: wertet das Argument zweimal aus und begrenzt nicht
+#define TEMP_Q4(celsius) ((temp_q4_t)((celsius) * 16.0f + (((celsius) < 0) ? -0.5f : 0.5f)))
+
+/// Plausibler Messbereich des Sensors in °C; geprüft wird nach der Umrechnung
+/// gegen TEMP_Q4(TEMP_C_MIN) .. TEMP_Q4(TEMP_C_MAX)
+#define TEMP_C_MIN (-100.0f)
+#define TEMP_C_MAX 200.0f
+
+/// °C -> temp_q4_t (gerundet) für Messwerte zur Laufzeit; begrenzt auf den Wertebereich,
+/// NaN ergibt 0x7FFF. Eine Gleitkomma-Multiplikation, gerundet wird ganzzahlig.
+static inline temp_q4_t temp_q4_from_c(float celsius)
+{
+    if (!(celsius < 2047.0f))
+        return (temp_q4_t)0x7FFF;
+    if (celsius < -2048.0f)
+        return (temp_q4_t)-0x8000;
+    int32_t q5 = (int32_t)(celsius * 32.0f); // 1/32 °C, zur Null hin abgeschnitten
+    return (temp_q4_t)((q5 + ((q5 < 0) ? -1 : 1)) / 2);
+}
+/// temp_q4_t -> °C, nur für Debug-Ausgaben und Schnittstellen mit float-Parametern
+#define TEMP_Q4_TO_C(q4) ((float)(q4) / 16.0f)
+
 /**
  * @struct record_t
  * @brief Struktur eines Sensordatensatzes
  *
  * Wird im internen oder externen Flash gespeichert und über Funk übertragen.
- * Die Temperatur ist als Gleitkommazahl gespeichert, wird jedoch zur Übertragung konvertiert.
+ * Die Temperatur ist als Festkommawert (temp_q4_t) gespeichert.
  */
 typedef struct  {
     timestamp_t timestamp;  ///< Zeitstempel in 5-Minuten-Schritten
-    float temperature;      ///< Temperatur in °C
+    temp_q4_t temperature;  ///< Temperatur in 1/16 °C
     uint8_t flags;          ///< Statusbits (nur untere 4 Bit genutzt, z. B. CRC-valid, Sensorfehler)
 } record_t;
 
+/// Flag in record_t::flags: Vor diesem Datensatz gingen gepufferte Datensätze verloren (Reset/Brownout)
+#define RECORD_FLAG_DATA_LOST 0x08
+
+/**
+ * @struct record_compact_t
+ * @brief Kompakter RAM-Datensatz für Messreihen mit festem Intervall (3 Byte statt 9)
+ *
+ * Der Zeitstempel ist relativ zu einem gemeinsamen Basiszeitstempel der Reihe
+ * gespeichert, die Temperatur als Festkommawert mit der Auflösung des
+ * Flash-Logs (1/16 °C). Die Flags gelten für alle Einträge einer Reihe.
+ */
+typedef struct {
+    uint8_t ts_offset; ///< Zeitstempel - Basiszeitstempel (5-Minuten-Schritte)
+    temp_q4_t temp_q4; ///< Temperatur in 1/16 °C
+} record_compact_t;
+
 /**
  * @enum mode_t
  * @brief Betriebsmodi des Sensorsystems (Zustandsmaschine)
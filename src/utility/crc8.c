@@ -1,4 +1,37 @@
 #include <stdint.h>
+#include "utility/crc8.h"
+
+// Gemeinsame CRC-Routinen für alle Integritätsprüfungen.
+// Statt acht Schiebe-/XOR-Schritten pro Byte werden zwei Nibbles über eine
+// Tabelle mit 16 Einträgen verarbeitet (passt ins Flash des STM8). Die
+// Tabellen werden vom Compiler aus dem Polynom berechnet.
+
+#define CRC8_POLY 0x1D
+#define CRC4_POLY 0x03
+
+#define CRC_STEP(c, poly) ((uint8_t)(((c) & 0x80) ? (((c) << 1) ^ (poly)) : ((c) << 1)))
+#define CRC_NIBBLE(n, poly) \
+    CRC_STEP(CRC_STEP(CRC_STEP(CRC_STEP((uint8_t)((n) << 4), poly), poly), poly), poly)
+#define CRC_TABLE(poly)                                                                      \
+    {                                                                                        \
+        CRC_NIBBLE(0, poly), CRC_NIBBLE(1, poly), CRC_NIBBLE(2, poly), CRC_NIBBLE(3, poly),     \
+            CRC_NIBBLE(4, poly), CRC_NIBBLE(5, poly), CRC_NIBBLE(6, poly), CRC_NIBBLE(7, poly), \
+            CRC_NIBBLE(8, poly), CRC_NIBBLE(9, poly), CRC_NIBBLE(10, poly),                     \
+            CRC_NIBBLE(11, poly), CRC_NIBBLE(12, poly), CRC_NIBBLE(13, poly),                   \
+            CRC_NIBBLE(14, poly), CRC_NIBBLE(15, poly)                                          \
+    }
+
+static const uint8_t crc8_table[16] = CRC_TABLE(CRC8_POLY);
+static const uint8_t crc4_table[16] = CRC_TABLE(CRC4_POLY);
+
+uint8_t crc8_update(uint8_t crc, const uint8_t* data, uint16_t len) {
+    while (len--) {
+        crc ^= *data++;
+        crc = (uint8_t)(crc << 4) ^ crc8_table[crc >> 4];
+        crc = (uint8_t)(crc << 4) ^ crc8_table[crc >> 4];
+    }
+    return crc;
+}
 
 // CRC-8-ATM (auch bekannt als CRC-8)
 // Polynom: x^8 + x^2 + x + 1 (0x07), Init: 0x00
@@ -12,3 +45,9 @@ uint8_t crc8_calc(const uint8_t* data, uint8_t len) {
     }
     return crc;
 }
+
+uint8_t crc4_calc(uint8_t value) {
+    value = (uint8_t)(value << 4) ^ crc4_table[value >> 4];
+    value = (uint8_t)(value << 4) ^ crc4_table[value >> 4];
+    return value & 0x0F;
+}
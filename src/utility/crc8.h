@@ -3,6 +3,31 @@
 
 #include <stdint.h>
 
+/**
+ * @brief Führt eine CRC-8 (Polynom 0x1D, MSB zuerst) über einen Puffer fort.
+ *
+ * Inkrementell nutzbar: das Ergebnis eines Aufrufs ist der Startwert des
+ * nächsten. Die Länge ist 16 Bit breit, damit ganze Flash-Seiten in einem
+ * Aufruf geprüft werden können.
+ * @param crc bisheriger CRC-Wert bzw. Startwert
+ * @param data zu prüfende Bytes
+ * @param len Anzahl Bytes
+ * @return neuer CRC-Wert
+ */
+uint8_t crc8_update(uint8_t crc, const uint8_t* data, uint16_t len);
+
+/**
+ * @brief CRC-8-ATM (Polynom 0x07, Startwert 0x00) über einen Puffer.
+ *
+ * Unverändert für bestehende Nutzer; neue Prüfsummen verwenden crc8_update().
+ */
 uint8_t crc8_calc(const uint8_t* data, uint8_t len);
 
+/**
+ * @brief 4-Bit-Prüfsumme eines Bytes (CRC-8 mit Polynom 0x03, untere 4 Bit).
+ *
+ * Wird für die Zeitstempel im Flash-Log verwendet.
+ */
+uint8_t crc4_calc(uint8_t value);
+
 #endif